@@ -22,10 +22,10 @@ setup(
         "License :: OSI Approved :: GNU Lesser General Public License v3 (LGPLv3)",
         "Operating System :: POSIX :: Linux",
         "Programming Language :: Python :: 3",
-        "Programming Language :: Python :: 3.6",
-        "Programming Language :: Python :: 3.7",
         "Programming Language :: Python :: 3.8",
         "Programming Language :: Python :: 3.9",
+        "Programming Language :: Python :: 3.10",
+        "Programming Language :: Python :: 3.11",
         "Topic :: Software Development :: Libraries :: Python Modules",
     ],
     ext_modules=extensions,
@@ -38,7 +38,7 @@ setup(
     packages=find_packages(where="src"),
     package_data={"": ["*.txt"]},
     package_dir={"": "src"},
-    python_requires=">=3.6",
+    python_requires=">=3.8",
     tests_require=["pytest"],
     url="https://github.com/1mikegrn/slots_factory",
     version="0.2.7",
@@ -6,4 +6,6 @@ __all__ = [
     "slots_from_type",
     "fast_slots",
     "dataslots",
+    "lazy",
+    "stats",
 ]
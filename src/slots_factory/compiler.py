@@ -0,0 +1,482 @@
+"""ahead of time compilation of the @dataslots types of a module.
+
+For each type, the generated extension holds a storage type with a typed
+member per slot, at offsets fixed by a C struct, and an __init__ unrolled
+over those slots. `@dataslots` looks for the extension of the module it
+decorates in, `<module>_slots`, and builds its types on the compiled storage,
+falling back to the dynamic one, with a RuntimeWarning, for any type that no
+longer matches what was compiled.
+
+    # setup.py, the module has to be importable at build time
+    from slots_factory.compiler import extension
+    setup(..., ext_modules=[extension("pkg.models")])
+
+    # or straight into the source tree
+    python -m slots_factory.compiler pkg.models --build
+"""
+
+import argparse
+import importlib
+import os
+import sys
+
+from .slots_factory import DSMeta
+
+# the declarations slots_factory_tools.c reads compiled schemas with
+ABI = 1
+
+_NATIVES = {
+    "?": ("T_BOOL", "char", "slots_store_bool"),
+    "d": ("T_DOUBLE", "double", "slots_store_double"),
+    "q": ("T_LONGLONG", "long long", "slots_store_longlong"),
+}
+
+_PREAMBLE = """\
+// generated by slots_factory.compiler from {source}, do not edit
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+// a copy of the declarations in slots_factory_tools.c
+#define SLOTS_COMPILED_ABI {abi}
+#define SLOTS_COMPILED_CAPSULE "slots_factory.compiled_schema"
+
+typedef struct {{
+    PyObject *value;
+    int factory;
+}} SlotsDefault;
+
+typedef int (*SlotsCompiledStore)(int kind, char *field, PyObject *value);
+
+typedef struct {{
+    int abi;
+    const char *qualname;
+    Py_ssize_t size;
+    const char *const *names;
+    const int *kinds;
+    const Py_ssize_t *offsets;
+    PyType_Spec *spec;
+    int (*init)(
+        PyObject *self, PyObject *const *values, Py_ssize_t npositional, PyObject *kwnames,
+        const Py_ssize_t *positions, PyObject *const *names, const SlotsDefault *prototype,
+        SlotsCompiledStore store
+    );
+}} SlotsCompiledSchema;
+
+
+static inline PyObject* slots_default(const SlotsDefault *prototype) {{
+    // new reference to the default of a slot, NULL without an exception for
+    // a slot that has none
+    if (prototype->value == NULL) {{
+        return NULL;
+    }}
+    if (prototype->factory) {{
+        return PyObject_CallObject(prototype->value, NULL);
+    }}
+    Py_INCREF(prototype->value);
+    return prototype->value;
+}}
+
+
+static inline int slots_store_longlong(char *field, PyObject *value, SlotsCompiledStore store) {{
+    if (PyLong_CheckExact(value)) {{
+        int overflow;
+        long long native = PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (!overflow) {{
+            *(long long *)field = native;
+            return 0;
+        }}
+    }}
+    return store(T_LONGLONG, field, value);
+}}
+
+
+static inline int slots_store_double(char *field, PyObject *value, SlotsCompiledStore store) {{
+    if (PyFloat_CheckExact(value)) {{
+        *(double *)field = PyFloat_AS_DOUBLE(value);
+        return 0;
+    }}
+    return store(T_DOUBLE, field, value);
+}}
+
+
+static inline int slots_store_bool(char *field, PyObject *value, SlotsCompiledStore store) {{
+    if (PyBool_Check(value)) {{
+        *field = value == Py_True;
+        return 0;
+    }}
+    return store(T_BOOL, field, value);
+}}
+"""
+
+_MODULE = """
+
+static int slots_exec(PyObject *module) {{
+    PyObject *schemas = PyDict_New();
+    if (schemas == NULL) {{
+        return -1;
+    }}
+    static SlotsCompiledSchema *compiled[] = {{{schemas}}};
+    for (size_t i=0; i<sizeof(compiled) / sizeof(compiled[0]); i++) {{
+        if (compiled[i] == NULL) {{
+            continue;
+        }}
+        PyObject *capsule = PyCapsule_New(compiled[i], SLOTS_COMPILED_CAPSULE, NULL);
+        if (capsule == NULL || PyDict_SetItemString(schemas, compiled[i]->qualname, capsule) == -1) {{
+            Py_XDECREF(capsule);
+            Py_DECREF(schemas);
+            return -1;
+        }}
+        Py_DECREF(capsule);
+    }}
+    if (PyModule_AddObject(module, "__slots_schemas__", schemas) == -1) {{
+        Py_DECREF(schemas);
+        return -1;
+    }}
+    return 0;
+}}
+
+
+static PyModuleDef_Slot slots_module_slots[] = {{
+    {{Py_mod_exec, slots_exec}},
+#if PY_VERSION_HEX >= 0x030C0000
+    {{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED}},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    {{Py_mod_gil, Py_MOD_GIL_USED}},
+#endif
+    {{0, NULL}}
+}};
+
+
+static struct PyModuleDef slots_module = {{
+    PyModuleDef_HEAD_INIT,
+    .m_name = "{module}",
+    .m_doc = "compiled schemas of the dataslots types in {source}",
+    .m_size = 0,
+    .m_slots = slots_module_slots,
+}};
+
+
+PyMODINIT_FUNC PyInit_{leaf}(void) {{
+    return PyModuleDef_Init(&slots_module);
+}}
+"""
+
+
+def _c_string(value):
+    # printable ASCII as is, every other byte of the UTF-8 escaped
+    return '"' + "".join(
+        chr(byte) if 32 <= byte < 127 and chr(byte) not in '"\\?' else f"\\{byte:03o}"
+        for byte in value.encode("utf-8")
+    ) + '"'
+
+
+def compiled_module(module):
+    """name of the extension `@dataslots` looks for the schemas of module in"""
+    return module + "_slots"
+
+
+def _packed(type_):
+    # the native fields of the storage base of type_, in struct_format order
+    for base in type_.__mro__[1:]:
+        if "__slots_packed__" in base.__dict__:
+            return dict(zip(base.__dict__["__slots_packed__"], base.__dict__.get("struct_format", "@")[1:]))
+    return {}
+
+
+def schema(type_):
+    """the slots of a @dataslots type, as (name, kind) pairs in __slots__
+    order, kind being one of the struct_format characters of a native field
+    or None for an object"""
+    if not isinstance(type_, DSMeta) or "__slots_layout__" not in type_.__dict__:
+        raise TypeError(f"{type_!r} isn't a @dataslots type")
+    natives = _packed(type_)
+    return [(name, natives.get(name)) for name in type_.__slots__]
+
+
+def types(module):
+    """the @dataslots types defined at the top level of module"""
+    return [
+        value for value in vars(module).values()
+        if isinstance(value, DSMeta)
+        and value.__module__ == module.__name__
+        and "__slots_layout__" in value.__dict__
+    ]
+
+
+def _storage(prefix, type_, slots):
+    # natives first, in the order of __slots_packed__, so they make up the
+    # struct_format record right after the object header
+    index = {name: i for i, (name, _) in enumerate(slots)}
+    objects = [i for i, (_, kind) in enumerate(slots) if kind is None]
+    order = [index[name] for name in _packed(type_)] + objects
+
+    lines = [f"\n\n// {type_.__module__}.{type_.__qualname__}", "typedef struct {", "    PyObject_HEAD"]
+    for i in order:
+        name, kind = slots[i]
+        ctype = "PyObject *" if kind is None else _NATIVES[kind][1] + " "
+        lines.append(f"    {ctype}f{i};  // {name}")
+    lines.append(f"}} {prefix}_fields;")
+
+    if objects:
+        lines += [
+            "", "",
+            f"static int {prefix}_traverse(PyObject *self, visitproc visit, void *arg) {{",
+            f"    {prefix}_fields *fields = ({prefix}_fields *)self;",
+            "#if PY_VERSION_HEX >= 0x03090000",
+            "    Py_VISIT(Py_TYPE(self));",
+            "#endif",
+            *(f"    Py_VISIT(fields->f{i});" for i in objects),
+            "    return 0;",
+            "}",
+            "", "",
+            f"static int {prefix}_clear(PyObject *self) {{",
+            f"    {prefix}_fields *fields = ({prefix}_fields *)self;",
+            *(f"    Py_CLEAR(fields->f{i});" for i in objects),
+            "    return 0;",
+            "}",
+        ]
+    lines += [
+        "", "",
+        f"static void {prefix}_dealloc(PyObject *self) {{",
+        "    PyTypeObject *type = Py_TYPE(self);",
+    ]
+    if objects:
+        lines += [
+            "    if (PyType_IS_GC(type)) {",
+            "        PyObject_GC_UnTrack(self);",
+            "    }",
+            f"    {prefix}_clear(self);",
+        ]
+    lines += [
+        "    type->tp_free(self);",
+        "    Py_DECREF(type);",
+        "}",
+        "", "",
+        f"static PyMemberDef {prefix}_members[] = {{",
+        *(
+            f"    {{{_c_string(name)}, {'T_OBJECT_EX' if kind is None else _NATIVES[kind][0]},"
+            f" offsetof({prefix}_fields, f{i}), 0, NULL}},"
+            for i, (name, kind) in enumerate(slots)
+        ),
+        "    {NULL}",
+        "};",
+        "", "",
+        f"static PyType_Slot {prefix}_slots[] = {{",
+        f"    {{Py_tp_members, {prefix}_members}},",
+    ]
+    if objects:
+        lines += [
+            f"    {{Py_tp_traverse, {prefix}_traverse}},",
+            f"    {{Py_tp_clear, {prefix}_clear}},",
+        ]
+    lines += [
+        f"    {{Py_tp_dealloc, {prefix}_dealloc}},",
+        f"    {{Py_tp_doc, {_c_string('compiled storage for ' + type_.__qualname__)}}},",
+        "    {0, NULL}",
+        "};",
+        "", "",
+        f"static PyType_Spec {prefix}_spec = {{",
+        f"    .name = {_c_string(compiled_module(type_.__module__) + '.' + type_.__name__ + 'Storage')},",
+        f"    .basicsize = sizeof({prefix}_fields),",
+        "    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE" + (" | Py_TPFLAGS_HAVE_GC," if objects else ","),
+        f"    .slots = {prefix}_slots,",
+        "};",
+    ]
+    return lines
+
+
+def _store(prefix, i, kind, value, owned):
+    # a statement storing value in slot i, owned when it's a new reference
+    field = f"fields->f{i}"
+    if kind is None:
+        if owned:
+            return [f"Py_XSETREF({field}, {value});"]
+        return [f"Py_INCREF({value});", f"Py_XSETREF({field}, {value});"]
+    store = f"{_NATIVES[kind][2]}((char *)&{field}, {value}, store)"
+    if not owned:
+        return [f"if ({store} == -1) {{", "    return -1;", "}"]
+    return [
+        f"int stored = {store};",
+        f"Py_DECREF({value});",
+        "if (stored == -1) {",
+        "    return -1;",
+        "}",
+    ]
+
+
+def _init(prefix, slots):
+    size = len(slots)
+    lines = [
+        "", "",
+        f"static int {prefix}_init(",
+        "    PyObject *self, PyObject *const *values, Py_ssize_t npositional, PyObject *kwnames,",
+        "    const Py_ssize_t *positions, PyObject *const *names, const SlotsDefault *prototype,",
+        "    SlotsCompiledStore store",
+        ") {",
+    ]
+    if not size:
+        # nothing to store, keywords are left to the generic path to reject
+        return lines + ["    return kwnames == NULL || PyTuple_GET_SIZE(kwnames) == 0;", "}"]
+    lines += [
+        f"    {prefix}_fields *fields = ({prefix}_fields *)self;",
+        "    Py_ssize_t nkwargs = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);",
+        f"    PyObject *given[{size}] = {{NULL}};",
+        "    PyObject *value;",
+        "",
+        "    for (Py_ssize_t i=0; i<npositional; i++) {",
+        "        given[positions[i]] = values[i];",
+        "    }",
+        "    // interned names only, anything else is left to the generic path",
+        "    for (Py_ssize_t i=0; i<nkwargs; i++) {",
+        "        PyObject *key = PyTuple_GET_ITEM(kwnames, i);",
+    ]
+    for i in range(size):
+        keyword = "if" if i == 0 else "} else if"
+        lines += [f"        {keyword} (key == names[{i}]) {{", f"            given[{i}] = values[npositional + i];"]
+    lines += ["        } else {", "            return 0;", "        }", "    }"]
+
+    lines.append("")
+    for i, (_, kind) in enumerate(slots):
+        lines.append(f"    if (given[{i}] != NULL) {{")
+        lines += ["        " + line for line in _store(prefix, i, kind, f"given[{i}]", False)]
+        lines.append("    }")
+
+    # the slots left get their prototype, in slot order like the generic path
+    lines.append("")
+    for i, (_, kind) in enumerate(slots):
+        lines += [
+            f"    if (given[{i}] == NULL) {{",
+            f"        value = slots_default(&prototype[{i}]);",
+            "        if (value != NULL) {",
+            *("            " + line for line in _store(prefix, i, kind, "value", True)),
+            "        } else if (PyErr_Occurred()) {",
+            "            return -1;",
+            "        }",
+            "    }",
+        ]
+    lines += ["    return 1;", "}"]
+    return lines
+
+
+def _schema(prefix, type_, slots):
+    size = len(slots)
+    names = ", ".join(_c_string(name) for name, _ in slots) or "NULL"
+    kinds = ", ".join("T_OBJECT_EX" if kind is None else _NATIVES[kind][0] for _, kind in slots) or "0"
+    offsets = ", ".join(f"offsetof({prefix}_fields, f{i})" for i in range(size)) or "0"
+    return [
+        "", "",
+        f"static const char *const {prefix}_names[] = {{{names}}};",
+        f"static const int {prefix}_kinds[] = {{{kinds}}};",
+        f"static const Py_ssize_t {prefix}_offsets[] = {{{offsets}}};",
+        "",
+        f"static SlotsCompiledSchema {prefix}_schema = {{",
+        f"    SLOTS_COMPILED_ABI, {_c_string(type_.__qualname__)}, {size},",
+        f"    {prefix}_names, {prefix}_kinds, {prefix}_offsets, &{prefix}_spec, {prefix}_init,",
+        "};",
+    ]
+
+
+def generate(module, types_=None):
+    """C source of the extension holding the schemas of the @dataslots types
+    of module, all of its top level ones by default"""
+    if types_ is None:
+        if isinstance(module, str):
+            module = importlib.import_module(module)
+        types_ = types(module)
+    source = module if isinstance(module, str) else module.__name__
+    name = compiled_module(source)
+    lines = [_PREAMBLE.format(source=source, abi=ABI)]
+    prefixes = []
+    for i, type_ in enumerate(types_):
+        prefix = f"s{i}"
+        slots = schema(type_)
+        lines += _storage(prefix, type_, slots)
+        lines += _init(prefix, slots)
+        lines += _schema(prefix, type_, slots)
+        prefixes.append(f"&{prefix}_schema")
+    lines.append(_MODULE.format(
+        schemas=", ".join(prefixes) or "NULL",
+        module=name,
+        source=source,
+        leaf=name.rpartition(".")[2],
+    ))
+    return "\n".join(lines)
+
+
+def write(module, directory="."):
+    """writes the C source of module's extension under directory, laid out
+    like the package, and returns its path"""
+    if isinstance(module, str):
+        module = importlib.import_module(module)
+    path = os.path.join(directory, *compiled_module(module.__name__).split(".")) + ".c"
+    os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+    source = generate(module)
+    # unchanged sources keep their timestamp, and the build its object files
+    try:
+        with open(path) as f:
+            if f.read() == source:
+                return path
+    except OSError:
+        pass
+    with open(path, "w") as f:
+        f.write(source)
+    return path
+
+
+def extension(module, directory=os.path.join("build", "slots_factory"), **kwargs):
+    """a setuptools Extension building module's schemas, from a source
+    written under directory. kwargs go to the Extension"""
+    from setuptools import Extension
+
+    if isinstance(module, str):
+        module = importlib.import_module(module)
+    return Extension(compiled_module(module.__name__), [write(module, directory)], **kwargs)
+
+
+def build(module, directory=None):
+    """compiles module's extension next to the module, or into directory,
+    and returns the path of the built extension"""
+    from setuptools import Distribution
+
+    if isinstance(module, str):
+        module = importlib.import_module(module)
+    if directory is None:
+        # the root the module's package was imported from
+        directory = os.path.dirname(os.path.abspath(module.__file__))
+        for _ in range(module.__name__.count(".")):
+            directory = os.path.dirname(directory)
+    temp = os.path.join(directory, "build", "slots_factory")
+    distribution = Distribution({"ext_modules": [extension(module, temp)]})
+    command = distribution.get_command_obj("build_ext")
+    command.build_lib = directory
+    command.build_temp = temp
+    command.ensure_finalized()
+    command.run()
+    return command.get_ext_fullpath(compiled_module(module.__name__))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        prog="python -m slots_factory.compiler",
+        description="compiles the schemas of the @dataslots types of modules into <module>_slots extensions",
+    )
+    parser.add_argument("modules", nargs="+", help="importable modules defining @dataslots types")
+    parser.add_argument("-d", "--directory", help="where sources and extensions go, the import root by default")
+    parser.add_argument("--build", action="store_true", help="compile the extensions, not only their sources")
+    options = parser.parse_args(argv)
+
+    # modules are named relative to the working directory, like python -m
+    sys.path.insert(0, os.getcwd())
+    for name in options.modules:
+        module = importlib.import_module(name)
+        if options.build:
+            print(build(module, options.directory))
+        else:
+            print(write(module, options.directory or "."))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
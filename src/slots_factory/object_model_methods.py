@@ -1,37 +1,42 @@
+from slots_factory.tools.SlotsFactoryTools import (
+    _slots_factory_from_rows,
+    _slots_factory_from_columns,
+    _slots_factory_from_dict,
+    _slots_factory_from_buffer,
+    _slots_factory_encode,
+    _slots_factory_encode_many,
+    _slots_factory_decode,
+    _slots_factory_decode_many,
+    SlotsArray,
+)
+
+
 def _frozen(self, *_, **__):
     """For setting instances as immutable, via pointing __setattr__ and
     __delattr__ here"""
     raise AttributeError("Instance is immutable")
 
 
-def _ordering_methods(_keys, _order):
-    """Methods to defining ordering. Includes a new __iter__, and the rich
-    comparisons"""
+def _field_order(_keys, _order):
+    """Attribute names in the order implied by the `order` option, falling
+    back to definition order"""
     if _order is True:
-        _order = sorted(_keys)
+        return sorted(_keys)
+    if _order:
+        return list(_order)
+    return list(_keys)
+
+
+def _ordering_methods(_keys, _order):
+    """Methods to defining ordering. Includes a new __iter__, the rich
+    comparisons themselves are native, see _slots_factory_methods"""
+    _order = _field_order(_keys, _order)
 
     def __iter__(self):
         for item in _order:
             yield item, getattr(self, item)
 
-    def __lt__(self, other):
-        for attr in _order:
-            left, right = getattr(self, attr), getattr(other, attr)
-            if left == right:
-                continue
-            if left < right:
-                return True
-            return False
-        return False
-
-    def __le__(self, other):
-        if self < other:
-            return True
-        elif self == other:
-            return True
-        return False
-
-    return {"__iter__": __iter__, "__lt__": __lt__, "__le__": __le__}
+    return {"__iter__": __iter__}
 
 
 def __repr__(self):
@@ -45,23 +50,48 @@ def __len__(self):
     return len(self.__slots__)
 
 
-def __eq__(self, other):
-    """SlotObjects are considered equal if both attributes and values match"""
-    try:
-        if len(self) != len(other):
-            return False
-        return all(
-            getattr(self, attr) == getattr(other, attr) for attr in self.__slots__
-        )
-    except AttributeError:
-        return False
+def __iter__(self):
+    for item in self.__slots__:
+        yield item, getattr(self, item)
+
+
+@classmethod
+def from_rows(cls, rows):
+    """builds a list of instances, one per row of positional values given in
+    `order` (or definition order)"""
+    return _slots_factory_from_rows(cls, rows)
 
 
-def __hash__(self):
-    """Hashing is determined by the attribute names"""
-    return hash(tuple(self.__slots__))
+@classmethod
+def from_columns(cls, columns):
+    """builds a list of instances from a dict of equal length sequences,
+    keyed by attribute name"""
+    return _slots_factory_from_columns(cls, columns)
 
 
-def __iter__(self):
-    for item in self.__slots__:
-        yield item, getattr(self, item)
+# builds an instance from a dict of attribute values, as if they were passed to
+# __init__ as keyword arguments. bound straight to the native function, a
+# Python level wrapper would cost as much as the construction itself
+from_dict = classmethod(_slots_factory_from_dict)
+
+
+# compact binary codec, bound as classmethods the same way: the fields of each
+# record in slot order without their names, behind a schema hash of the type
+encode = classmethod(_slots_factory_encode)
+encode_many = classmethod(_slots_factory_encode_many)
+decode = classmethod(_slots_factory_decode)
+decode_many = classmethod(_slots_factory_decode_many)
+
+
+@classmethod
+def from_buffer(cls, buffer, offset=0):
+    """builds an instance from the `struct_format` record at `offset` in a
+    bytes-like buffer, copying the packed fields straight into it"""
+    return _slots_factory_from_buffer(cls, buffer, offset)
+
+
+@classmethod
+def Array(cls, capacity=0):
+    """an empty SlotsArray of the type, storing instances column by column
+    with room for `capacity` of them before growing"""
+    return SlotsArray(cls, capacity)
@@ -1,23 +1,50 @@
+import importlib
 import itertools
-from types import new_class, FunctionType
+import os
+import sys
+import warnings
+from functools import total_ordering
+from types import new_class, CodeType
 
 
 from slots_factory.tools.SlotsFactoryTools import (
-    _slots_factory_hash,
-    _slots_factory_setattrs,
+    LazySlot,
+    type_cache,
+    shape_cache,
     _slots_factory_setattrs_slim,
-    _slots_factory_setattrs_from_object,
+    _slots_factory_from_type,
+    _slots_factory_layout,
+    _slots_factory_methods,
+    _slots_factory_pool,
+    _slots_factory_untracked,
+    _slots_factory_storage,
+    _slots_factory_classify,
+    _slots_factory_compiled,
+    _slots_factory_compiled_init,
+    _slots_factory_lazy,
+    _slots_factory_init,
+    _slots_factory_stats,
+    _slots_factory_stats_enable,
+    _slots_factory_stats_reset,
 )
 
 
 from .object_model_methods import (
     _frozen,
+    _field_order,
     _ordering_methods,
     __repr__,
     __len__,
-    __eq__,
-    __hash__,
     __iter__,
+    from_rows,
+    from_columns,
+    from_dict,
+    encode,
+    encode_many,
+    decode,
+    decode_many,
+    from_buffer,
+    Array,
 )
 
 
@@ -27,21 +54,106 @@ TYPEDEF_DICT_KEYS = {
     "__doc__",
     "__dict__",
     "__weakref__",
+    "__static_attributes__",
+    "__firstlineno__",
 }
 
 
-def slots_from_type(type_, **kwargs):
-    """Convenience function. Takes a type and kwargs, and instantiates the type
-    with kwargs assigned to corresponding attributes.
+ORDERING_METHODS = ("__lt__", "__le__", "__gt__", "__ge__")
 
-    :param type_: type as derived from type_factory()
-    :type type_: type
-    :return: instance of the type, with assigned attributes
-    :rtype: SlotsObject
-    """
-    instance = type_()
-    _slots_factory_setattrs_slim(instance, kwargs, False)
-    return instance
+
+# marks a dependent field as computed on first access instead of at __init__,
+# `z = lazy(lambda self: ...)`, or as a decorator on a method
+lazy = LazySlot
+
+PACKED_TYPES = {int: int, float: float, bool: bool, "int": int, "float": float, "bool": bool}
+
+
+slots_from_type = _slots_factory_from_type
+
+
+def _referenced_names(code):
+    """attribute and global names a code object (and the comprehensions or
+    nested functions inside it) refers to"""
+    names = set(code.co_names)
+    for const in code.co_consts:
+        if isinstance(const, CodeType):
+            names |= _referenced_names(const)
+    return names
+
+
+def _dependency_order(_dependents):
+    """the dependents reordered so each comes after the dependents its lambda
+    reads, otherwise keeping definition order. names are read off the code
+    objects, so this over-approximates; a cycle is broken at its first
+    dependent in definition order"""
+    pending = {
+        k: _referenced_names(v.__code__) & _dependents.keys() - {k}
+        for k, v in _dependents.items()
+    }
+    ordered = {}
+    while pending:
+        ready = [k for k, deps in pending.items() if not deps - ordered.keys()]
+        for k in ready or [next(iter(pending))]:
+            ordered[k] = _dependents[k]
+            del pending[k]
+    return ordered
+
+
+# schemas compiled by slots_factory.compiler, by module and then qualname
+_compiled_schemas = {}
+
+
+def _compiled_schema(f):
+    """the compiled schema of the class f, from the `<module>_slots`
+    extension of its module, None when it has none"""
+    module = getattr(f, "__module__", None)
+    schemas = _compiled_schemas.get(module)
+    if schemas is None:
+        schemas = {}
+        if (
+            isinstance(module, str) and module != "__main__"
+            and os.environ.get("SLOTS_FACTORY_COMPILED", "") != "0"
+        ):
+            name = module + "_slots"
+            try:
+                schemas = importlib.import_module(name).__slots_schemas__
+            except ModuleNotFoundError as e:
+                if e.name != name:
+                    raise
+        _compiled_schemas[module] = schemas
+    return schemas.get(f.__qualname__)
+
+
+def _compiled_storage(f, _args, _packed):
+    """the schema and storage type compiled for the class f, (None, None)
+    when there is none or it no longer matches the class"""
+    schema = _compiled_schema(f)
+    if schema is None:
+        return None, None
+    try:
+        return schema, _slots_factory_compiled(schema, _args, _packed)
+    except ValueError as e:
+        # reported at the class definition, past the frames of this module
+        level, frame = 1, sys._getframe()
+        while frame is not None and frame.f_code.co_filename == __file__:
+            level, frame = level + 1, frame.f_back
+        warnings.warn(
+            f"{f.__module__}.{f.__qualname__} doesn't match its compiled schema, {e};"
+            " rebuild its extension with slots_factory.compiler",
+            RuntimeWarning,
+            stacklevel=level,
+        )
+        return None, None
+
+
+def _build_type(cache, _name, attrs, **kwargs):
+    """the type for the keys of `attrs` in `cache`, built by `type_factory` on
+    a miss. only one thread at a time builds, the others wait and share its
+    type"""
+    return cache.get_or_build(
+        _name, attrs, lambda: type_factory(attrs.keys(), _name, **kwargs)
+    )
 
 
 def slots_from_dict(attrs={}, _name="SlotsObject", **kwargs):
@@ -56,12 +168,14 @@ def slots_from_dict(attrs={}, _name="SlotsObject", **kwargs):
     :return: SlotsObject instance
     :rtype: SlotsObject
     """
-    if not kwargs.get("order"):
-        kwargs["order"] = attrs.keys()
-    type_ = fast_slots.__dict__.get(_name)
-    if not type_:
-        fast_slots.__dict__[_name] = type_factory(attrs.keys(), _name, **kwargs)
-    return fast_slots(_name, **attrs)
+    type_ = fast_slots.cache.get(_name, attrs)
+    if type_ is None:
+        if not kwargs.get("order"):
+            kwargs["order"] = attrs.keys()
+        type_ = _build_type(fast_slots.cache, _name, attrs, **kwargs)
+    instance = type_()
+    _slots_factory_setattrs_slim(instance, attrs, False)
+    return instance
 
 
 def type_factory(args, _name="Slots_Object", _bases=(), _metaclass=type, **kwargs):
@@ -82,10 +196,12 @@ def type_factory(args, _name="Slots_Object", _bases=(), _metaclass=type, **kwarg
         "__slots__": args,
         "__iter__": __iter__,
         "__len__": __len__,
-        "__eq__": __eq__,
-        "__hash__": __hash__,
         "__repr__": __repr__,
     }
+    native = [
+        "__eq__", "__hash__", "to_dict", "to_tuple", "asdict",
+        "__reduce__", "__reduce_ex__", "replace", "__copy__", "__deepcopy__",
+    ]
 
     frozen = kwargs.get("frozen")
     if frozen:
@@ -97,17 +213,63 @@ def type_factory(args, _name="Slots_Object", _bases=(), _metaclass=type, **kwarg
         methods.update(
             _ordering_methods(args, _order)
         )
+        native += ["sort_key", *ORDERING_METHODS]
 
     _methods = kwargs.get("_methods")
     if _methods:
         methods.update(**_methods)
 
-    return new_class(
-        _name,
-        _bases,
-        kwds={"metaclass": _metaclass},
-        exec_body=lambda ns: ns.update(methods),
+    # user defined comparisons take precedence over all the native ones, with
+    # the missing ones derived from them in total_ordering fashion
+    derived = _order and any(name in methods for name in ORDERING_METHODS)
+    if derived:
+        native = [name for name in native if name not in ORDERING_METHODS]
+
+    # packed fields live natively in a storage base, only the rest are slots.
+    # a compiled storage base holds every field, objects included
+    _packed = kwargs.get("_packed")
+    _compiled = kwargs.get("_compiled")
+    if _compiled is not None:
+        _bases = (_compiled, *_bases)
+        methods["__slots__"] = ()
+    elif _packed:
+        _bases = (_slots_factory_storage(_packed), *_bases)
+        methods["__slots__"] = [arg for arg in args if arg not in _packed]
+
+    # new_class only adds __mro_entries__ and __prepare__ resolution, neither
+    # of which our own metaclasses over plain type bases need
+    if _metaclass in (type, DSMeta) and all(type(base) in (type, _metaclass) for base in _bases):
+        type_ = _metaclass(_name, _bases, dict(methods))
+    else:
+        type_ = new_class(
+            _name,
+            _bases,
+            kwds={"metaclass": _metaclass},
+            exec_body=lambda ns: ns.update(methods),
+        )
+    if _packed or _compiled is not None:
+        type_.__slots__ = args
+    type_.__slots_layout__ = _slots_factory_layout(type_)
+    _slots_factory_methods(
+        type_,
+        [name for name in native if name not in methods and name not in args],
+        _field_order(args, _order) if _order else None,
     )
+    if derived:
+        type_ = total_ordering(type_)
+
+    _lazy = kwargs.get("_lazy")
+    if _lazy:
+        _slots_factory_lazy(type_, _lazy)
+
+    # instances holding no objects at all can't be part of a cycle
+    if kwargs.get("gc", True) is False or (_packed and all(arg in _packed for arg in args)):
+        _slots_factory_untracked(type_)
+
+    pool = kwargs.get("pool")
+    if pool:
+        _slots_factory_pool(type_, pool)
+    return type_
 
 
 def slots_factory(_name="SlotsObject", **kwargs):
@@ -121,19 +283,22 @@ def slots_factory(_name="SlotsObject", **kwargs):
     :return: returns an instance of the type built for the python object
     :rtype: SlotsObject
     """
-    id_ = _slots_factory_hash(_name, kwargs)
-    type_ = slots_factory.__dict__.get(id_)
-    if not type_:
-        type_ = type_factory(kwargs.keys(), _name, order=kwargs.keys())
-        slots_factory.__dict__[id_] = type_
+    type_ = slots_factory.cache.get(_name, kwargs)
+    if type_ is None:
+        type_ = _build_type(slots_factory.cache, _name, kwargs, order=kwargs.keys())
     instance = type_()
     _slots_factory_setattrs_slim(instance, kwargs, False)
     return instance
 
 
+# the caches live in the extension's module state, reads never lock
+slots_factory.cache = type_cache
+
+
 def fast_slots(_name="SlotsObject", **kwargs):
     """Factory function for creating python objects with __slots__. Only uses
-    name for caching, and makes a new object type when AttributeError is raised.
+    name for caching, and keeps the last few shapes (sets of attribute names)
+    seen for each name, so alternating shapes don't rebuild their types.
 
     :param _name: type name to tag to type definition, defaults to "SlotsObject"
     :type _name: str, optional
@@ -143,17 +308,51 @@ def fast_slots(_name="SlotsObject", **kwargs):
     :return: returns an instance of the type built for the python object
     :rtype: SlotsObject
     """
-    type_ = fast_slots.__dict__.get(_name)
-    if not type_:
-        type_ = type_factory(kwargs.keys(), _name, order=kwargs.keys())
-        fast_slots.__dict__[_name] = type_
-    try:
-        instance = type_()
-        _slots_factory_setattrs_slim(instance, kwargs, True)
-        return instance
-    except AttributeError:
-        del fast_slots.__dict__[_name]
-        return fast_slots(_name, **kwargs)
+    type_ = fast_slots.cache.get(_name, kwargs)
+    if type_ is None:
+        type_ = _build_type(fast_slots.cache, _name, kwargs, order=kwargs.keys())
+    instance = type_()
+    _slots_factory_setattrs_slim(instance, kwargs, False)
+    return instance
+
+
+fast_slots.cache = shape_cache
+
+
+def stats():
+    """counters kept by the extension since `stats.enable()`, for finding the
+    types that dominate allocation and the names that keep rebuilding.
+
+    "types" maps each type counted to its instances "created" (by __init__
+    and the factory functions), cache "hits", "frozen" constructions, and
+    the nanoseconds spent in its callables and dependents. "slots_factory"
+    and "fast_slots" map each name asked of their caches to its "misses",
+    "builds" and "rebuilds", builds after the first. Off, the counters cost
+    a single load; SLOTS_FACTORY_STATS=1 in the environment turns them on
+    at import.
+
+    :return: the counters, and whether they are "enabled"
+    :rtype: dict
+    """
+    return _slots_factory_stats()
+
+
+stats.enable = lambda: _slots_factory_stats_enable(True)
+stats.disable = lambda: _slots_factory_stats_enable(False)
+stats.reset = _slots_factory_stats_reset
+
+if os.environ.get("SLOTS_FACTORY_STATS", "") not in ("", "0"):
+    stats.enable()
+
+
+def _slots_type(_name, names):
+    """the fast_slots type for `names`, used to unpickle instances of types
+    this process has not built yet"""
+    kwargs = dict.fromkeys(names)
+    type_ = fast_slots.cache.get(_name, kwargs)
+    if type_ is None:
+        type_ = _build_type(fast_slots.cache, _name, kwargs, order=kwargs.keys())
+    return type_
 
 
 def dataslots(_cls=None, **ds_kwargs):
@@ -166,79 +365,94 @@ def dataslots(_cls=None, **ds_kwargs):
     :param frozen: optional flag for ensuring data is immutable
     :type frozen: bool
 
+    :param positional: optional flag for accepting attribute values as
+    positional arguments, in `order` (or definition order)
+    :type positional: bool
+
+    :param pool: optional number of deallocated instances to keep for reuse
+    by the next instances of the type
+    :type pool: int
+
+    :param packed: optional flag for storing the attributes annotated int,
+    float or bool as native 64 bit ints, doubles and bools, unboxed inside
+    the instance
+    :type packed: bool
+
+    :param gc: optional flag, False leaves instances out of cyclic garbage
+    collection, for types whose attributes never reference back to them
+    :type gc: bool
+
     :return: wrapper functions
     :rtype: function
     """
 
     def wrapper(f):
         """wrapper called to generate the type at runtime"""
-        _attrs, _methods, _callables, _dependents = {}, {}, {}, {}
+        _attrs, _methods, _callables, _dependents, _lazy, _defaults = (
+            _slots_factory_classify(f, TYPEDEF_DICT_KEYS)
+        )
 
-        _seen_keys = set()
-        for (attr, collection) in (
-            (attr, getattr(f, attr))
-            for attr in ("__dict__", "__annotations__")
-            if hasattr(f, attr)
-        ):
-            for k, v in collection.items():
-                if k in TYPEDEF_DICT_KEYS or k in _seen_keys:
-                    continue
-                if isinstance(v, type) and attr == "__dict__":
-                    _callables[k] = v
-                elif isinstance(v, FunctionType):
-                    if v.__name__ == "<lambda>":
-                        if v.__code__.co_argcount == 1:
-                            _dependents[k] = v
-                        elif v.__code__.co_argcount == 0:
-                            _callables[k] = v
-                        else:
-                            raise SyntaxError(
-                                "lambda-type factory functions"
-                                " must take either 'self' as an argument,"
-                                " or take no arguments"
-                            )
-                    else:
-                        _methods[k] = v
-                elif isinstance(v, property):
-                    _methods[k] = v
-                else:
-                    _attrs[k] = v
-                _seen_keys.add(k)
-
-        _defaults = {key: getattr(f, key) for key in _attrs.keys() if hasattr(f, key)}
-
-        if not getattr(wrapper, "ds_kwargs", False):
-            if not (_defaults or _callables or _dependents):
-                def __init__(self, **kwargs):
-                    """slim"""
-                    _slots_factory_setattrs_slim(self, kwargs, False)
-            else:
-                def __init__(self, **kwargs):
-                    """generic"""
-                    _slots_factory_setattrs(
-                        self, _callables, _defaults, kwargs, _dependents, False
-                    )
-        else:
-            def __init__(self, **kwargs):
-                """frozen"""
-                _slots_factory_setattrs_from_object(
-                    object, self, _callables, _defaults, kwargs, _dependents
-                )
+        _args = list(itertools.chain(
+            _attrs.keys(), _callables.keys(), _dependents.keys(), _lazy.keys()
+        ))
+
+        # annotated attributes keep their definition order, ahead of the
+        # plain class attributes; dependents are computed, not passed
+        _annotations = getattr(f, "__annotations__", {})
+        _fields = [
+            k for k in itertools.chain(_annotations, _args)
+            if k in _args and k not in _dependents and k not in _lazy
+        ]
+
+        _packed = {}
+        if ds_kwargs.get("packed"):
+            _packed = {
+                k: PACKED_TYPES[v] for k, v in _annotations.items()
+                if k in _args and k not in _lazy and v in PACKED_TYPES
+            }
+
+        # dependents run in dependency order, their slots keep definition
+        # order. replace() reruns them by the names their lambdas read
+        __init__ = _slots_factory_init(
+            _callables,
+            _defaults,
+            _dependency_order(_dependents),
+            bool(ds_kwargs.get("frozen")),
+            _field_order(dict.fromkeys(_fields), ds_kwargs.get("order")),
+            bool(ds_kwargs.get("positional")),
+            {k: frozenset(_referenced_names(v.__code__)) for k, v in _dependents.items()},
+        )
 
+        # a schema compiled ahead of time brings the storage and the stores
+        _schema, _compiled = _compiled_storage(f, _args, _packed)
+        if _schema is not None:
+            _slots_factory_compiled_init(__init__, _schema)
 
         _ds_kwargs = {
             "_methods": {
-                "__init__": __init__, 
+                "__init__": __init__,
                 "__doc__": f.__doc__,
+                "__module__": f.__module__,
+                "__qualname__": f.__qualname__,
+                "from_rows": from_rows,
+                "from_columns": from_columns,
+                "from_dict": from_dict,
+                "encode": encode,
+                "encode_many": encode_many,
+                "decode": decode,
+                "decode_many": decode_many,
+                "from_buffer": from_buffer,
+                "Array": Array,
                 **_methods
             },
+            "_packed": _packed,
+            "_compiled": _compiled,
+            "_lazy": _lazy,
             **wrapper.__dict__["ds_kwargs"],
         }
 
         _type = type_factory(
-            args=list(itertools.chain(
-                _attrs.keys(), _callables.keys(), _dependents.keys()
-            )),
+            args=_args,
             _name=f.__name__,
             _bases=(),
             _metaclass=DSMeta,
@@ -249,6 +463,7 @@ def dataslots(_cls=None, **ds_kwargs):
         __init__.__dict__["_callables"] = _callables
         __init__.__dict__["_methods"] = _methods
         __init__.__dict__["_dependents"] = _dependents
+        __init__.__dict__["_lazy"] = _lazy
 
         return _type
 
@@ -259,6 +474,7 @@ def dataslots(_cls=None, **ds_kwargs):
     return wrapper(_cls)
 
 dataslots.__dict__["from_dict"] = slots_from_dict
+dataslots.__dict__["array"] = lambda type_, capacity=0: type_.Array(capacity)
 
 
 class DSMeta(type):
@@ -275,4 +491,6 @@ class DSMeta(type):
             except AttributeError:
                 pass
 
-        return super().__new__(cls, name, (), body)
+        return super().__new__(
+            cls, name, tuple(b for b in bases if not isinstance(b, DSMeta)), body
+        )
@@ -1,207 +1,5886 @@
 #include <Python.h>
+#include <structmember.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 
-unsigned long hash(unsigned char *str) {
+#if PY_VERSION_HEX < 0x03090000
+#define Py_TPFLAGS_HAVE_VECTORCALL _Py_TPFLAGS_HAVE_VECTORCALL
+#define PyInterpreterState_Get _PyInterpreterState_Get
+#endif
+
+
+// free-threaded builds guard shared tables with the object's own lock, the
+// GIL does the same job everywhere else
+#ifdef Py_GIL_DISABLED
+#define SLOTS_BEGIN_CRITICAL_SECTION(op) Py_BEGIN_CRITICAL_SECTION(op)
+#define SLOTS_END_CRITICAL_SECTION() Py_END_CRITICAL_SECTION()
+#else
+#define SLOTS_BEGIN_CRITICAL_SECTION(op) {
+#define SLOTS_END_CRITICAL_SECTION() }
+#endif
+
+
+// the extension types are heap types, one set per interpreter. they visit
+// their type from 3.9 and can refuse instantiation and mutation from 3.10
+#if PY_VERSION_HEX >= 0x03090000
+#define SLOTS_VISIT_TYPE(op) Py_VISIT(Py_TYPE(op))
+#else
+#define SLOTS_VISIT_TYPE(op)
+#endif
+#if PY_VERSION_HEX >= 0x030A0000
+#define SLOTS_TPFLAGS_IMMUTABLE Py_TPFLAGS_IMMUTABLETYPE
+#define SLOTS_TPFLAGS_NO_NEW Py_TPFLAGS_DISALLOW_INSTANTIATION
+#else
+#define SLOTS_TPFLAGS_IMMUTABLE 0
+#define SLOTS_TPFLAGS_NO_NEW 0
+#endif
+
+
+static unsigned long hash(const unsigned char *str) {
     unsigned long value = 5381;
     int c;
 
-    while (c = *str++) {
-        value = ((value << 5) + value) + c;
+    while ((c = *str++)) {
+        value = ((value << 5) + value) + c;
+    }
+    return value;
+}
+
+
+static int _slots_factory_nargs(const char *name, Py_ssize_t nargs, Py_ssize_t expected) {
+    if (nargs != expected) {
+        PyErr_Format(
+            PyExc_TypeError, "%s() takes exactly %zd arguments (%zd given)",
+            name, expected, nargs
+        );
+        return -1;
+    }
+    return 0;
+}
+
+
+static int _slots_factory_dict_arg(const char *name, PyObject *const *args, Py_ssize_t i) {
+    if (!PyDict_Check(args[i])) {
+        PyErr_Format(
+            PyExc_TypeError, "%s() argument %zd must be dict, not %.200s",
+            name, i + 1, Py_TYPE(args[i])->tp_name
+        );
+        return -1;
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_factory_hash(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_hash", nargs, 2) == -1) {
+        return NULL;
+    }
+    if (!PyUnicode_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_hash() argument 1 must be str");
+    }
+    if (_slots_factory_dict_arg("_slots_factory_hash", args, 1) == -1) {
+        return NULL;
+    }
+    const char *name = PyUnicode_AsUTF8(args[0]);
+    if (name == NULL) {
+        return NULL;
+    }
+
+    // the keys are xored together, so their order doesn't matter, and their
+    // UTF-8 is cached on the strings themselves
+    unsigned long _hash = hash((const unsigned char *)name);
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(args[1], &pos, &key, &value)) {
+        const char *encoded = PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : NULL;
+        if (encoded == NULL) {
+            return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_TypeError, "attribute names must be strings");
+        }
+        _hash ^= hash((const unsigned char *)encoded);
+    }
+
+    return PyLong_FromUnsignedLong(_hash);
+}
+
+
+typedef struct {
+    // what a type has been through while stats are on, read by
+    // _slots_factory_stats. listed once the type is in the state's list
+    long long created;
+    long long hits;
+    long long frozen;
+    long long callables_ns;
+    long long dependents_ns;
+    int listed;
+} SlotsStats;
+
+
+typedef struct {
+    PyObject_HEAD
+    PyTypeObject *type;
+    PyObject *names;
+    PyObject *index;
+    Py_ssize_t size;
+    Py_ssize_t *offsets;
+    PyMemberDef **members;
+    Py_ssize_t *order;
+    Py_ssize_t norder;
+    Py_hash_t hash;
+    unsigned long long schema;
+    // tells the type apart from others of the same schema in this process
+    unsigned long long serial;
+    PyObject *reduce;
+    PyObject **pool;
+    Py_ssize_t pool_size;
+    Py_ssize_t pooled;
+    freefunc pool_free;
+    Py_ssize_t lazy;
+    int direct;
+    int packed;
+    SlotsStats stats;
+} SlotsLayoutObject;
+
+
+typedef struct {
+    // everything the extension keeps between calls. each interpreter has its
+    // own, so isolated interpreters never share an object
+    PyTypeObject *layout_type;
+    PyTypeObject *init_type;
+    PyTypeObject *lazy_type;
+    PyTypeObject *type_cache_type;
+    PyTypeObject *shape_cache_type;
+    PyTypeObject *array_type;
+    PyTypeObject *array_view_type;
+    PyTypeObject *array_column_type;
+    PyObject *type_cache;
+    PyObject *shape_cache;
+    PyObject *slots_layout;
+    PyObject *slots_packed;
+    PyObject *init;
+    PyObject *struct_format;
+    PyObject *struct_size;
+    PyObject *registry;
+    PyObject *rebuild;
+    PyObject *rebuild_packed;
+    PyObject *pickle;
+    PyObject *deepcopy;
+    // what @dataslots reads off the classes it decorates
+    PyObject *class_dict;
+    PyObject *class_annotations;
+    // the names of _slots_object_methods, interned, in table order
+    PyObject *method_names;
+    // weak references to the types counted since stats were last reset
+    PyObject *stats_types;
+    // the last pooled layout used, which spares the tp_dict lookup while one
+    // type churns. borrowed, the layout resets it when it goes away
+    SlotsLayoutObject *pool_last;
+    // random per interpreter, so reduce keys only name types by serial to
+    // the interpreter that built them
+    unsigned long long nonce;
+    unsigned long long serial;
+    int stats;
+} SlotsFactoryState;
+
+
+#if defined(_MSC_VER)
+#define SLOTS_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+// a few words of the spare static TLS every loader keeps, read without a
+// call into the loader
+#define SLOTS_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define SLOTS_THREAD_LOCAL _Thread_local
+#endif
+
+
+// the state of the interpreter this thread last asked for. an interpreter
+// may be allocated where a finished one was, so any state going away makes
+// every thread look its state up again
+static SLOTS_THREAD_LOCAL PyInterpreterState *_slots_state_interp = NULL;
+static SLOTS_THREAD_LOCAL SlotsFactoryState *_slots_state_last = NULL;
+static SLOTS_THREAD_LOCAL Py_ssize_t _slots_state_seen = 0;
+static volatile Py_ssize_t _slots_state_generation = 1;
+
+
+// objects never leave the interpreter that made them, so while a single
+// interpreter has executed the module every call is from that one and
+// its state is found without asking which interpreter is running
+#define SLOTS_STATE_SHARED ((SlotsFactoryState *)&_slots_state_generation)
+static SlotsFactoryState *volatile _slots_state_only = NULL;
+
+
+#if defined(_MSC_VER)
+#define SLOTS_STATE_CLAIM(state) \
+    (_InterlockedCompareExchangePointer((void *volatile *)&_slots_state_only, (state), NULL) == NULL)
+#else
+#define SLOTS_STATE_CLAIM(state) \
+    __atomic_compare_exchange_n(&_slots_state_only, &(SlotsFactoryState *){NULL}, (state), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#endif
+
+
+#define SLOTS_STATE_KEY "slots_factory.tools.SlotsFactoryTools"
+
+
+static SlotsFactoryState* _slots_state_find(void) {
+    // borrowed, NULL without an exception before the module is executed in
+    // this interpreter or once it is torn down
+    SlotsFactoryState *only = _slots_state_only;
+    if (only != NULL && only != SLOTS_STATE_SHARED) {
+        return only->layout_type == NULL ? NULL : only;
+    }
+    PyInterpreterState *interp = PyInterpreterState_Get();
+    if (interp != _slots_state_interp || _slots_state_seen != _slots_state_generation) {
+        PyObject *dict = PyInterpreterState_GetDict(interp);
+        PyObject *module = dict == NULL ? NULL : PyDict_GetItemString(dict, SLOTS_STATE_KEY);
+        if (module == NULL || !PyModule_Check(module)) {
+            return NULL;
+        }
+        _slots_state_interp = interp;
+        _slots_state_seen = _slots_state_generation;
+        _slots_state_last = (SlotsFactoryState *)PyModule_GetState(module);
+    }
+    return _slots_state_last->layout_type == NULL ? NULL : _slots_state_last;
+}
+
+
+static SlotsFactoryState* _slots_state(void) {
+    SlotsFactoryState *state = _slots_state_find();
+    if (state == NULL && !PyErr_Occurred()) {
+        PyErr_SetString(PyExc_RuntimeError, "SlotsFactoryTools isn't loaded in this interpreter");
+    }
+    return state;
+}
+
+
+static SlotsLayoutObject* _slots_layout_in(SlotsFactoryState *state, PyTypeObject *type) {
+    // borrowed reference, NULL without an exception if the type has no layout.
+    // layouts only live on heap types, static types may not even have a
+    // tp_dict of their own
+    if (state == NULL || !PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE)) {
+        return NULL;
+    }
+    PyObject *layout = PyDict_GetItemWithError(type->tp_dict, state->slots_layout);
+    if (layout == NULL || Py_TYPE(layout) != state->layout_type) {
+        return NULL;
+    }
+    return (SlotsLayoutObject *)layout;
+}
+
+
+static inline SlotsLayoutObject* _slots_layout_of(PyTypeObject *type) {
+    return _slots_layout_in(_slots_state_find(), type);
+}
+
+
+// the number of interpreters keeping stats, so that while none does every
+// counter costs a single load
+static volatile long _slots_stats_active = 0;
+
+
+#if defined(_MSC_VER)
+#define SLOTS_STATS_ACTIVE_ADD(n) _InterlockedExchangeAdd(&_slots_stats_active, (n))
+#else
+#define SLOTS_STATS_ACTIVE_ADD(n) __atomic_fetch_add(&_slots_stats_active, (n), __ATOMIC_SEQ_CST)
+#endif
+
+
+static inline SlotsFactoryState* _slots_stats_state(void) {
+    // borrowed state while this interpreter keeps stats, NULL otherwise
+    if (!_slots_stats_active) {
+        return NULL;
+    }
+    SlotsFactoryState *state = _slots_state_find();
+    return state != NULL && state->stats ? state : NULL;
+}
+
+
+static int _slots_stats_list(SlotsFactoryState *state, SlotsLayoutObject *layout) {
+    PyObject *ref = PyWeakref_NewRef((PyObject *)layout->type, NULL);
+    if (ref == NULL || PyList_Append(state->stats_types, ref) == -1) {
+        Py_XDECREF(ref);
+        return -1;
+    }
+    Py_DECREF(ref);
+    layout->stats.listed = 1;
+    return 0;
+}
+
+
+static inline int _slots_stats(PyTypeObject *type, SlotsStats **stats) {
+    // *stats is given the counters of type while this interpreter keeps
+    // stats, and NULL when it doesn't or type has no layout
+    SlotsFactoryState *state = _slots_stats_state();
+    *stats = NULL;
+    if (state == NULL) {
+        return 0;
+    }
+    SlotsLayoutObject *layout = _slots_layout_in(state, type);
+    if (layout == NULL) {
+        return PyErr_Occurred() ? -1 : 0;
+    }
+    if (!layout->stats.listed && _slots_stats_list(state, layout) == -1) {
+        return -1;
+    }
+    *stats = &layout->stats;
+    return 0;
+}
+
+
+static long long _slots_stats_now(void) {
+    // monotonic nanoseconds, only read while stats are kept
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (
+        counter.QuadPart / frequency.QuadPart * 1000000000LL
+        + counter.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart
+    );
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+
+static inline int _slots_layout_owns(SlotsLayoutObject *layout, PyObject *instance) {
+    // stores can be written straight into the instance, bypassing __setattr__
+    return layout->direct && Py_TYPE(instance) == layout->type;
+}
+
+
+static inline int _slots_layout_direct(SlotsLayoutObject *layout, PyObject *instance) {
+    // stores can be written straight into the instance, same as __setattr__
+    return (
+        _slots_layout_owns(layout, instance)
+        && Py_TYPE(instance)->tp_setattro == PyObject_GenericSetAttr
+    );
+}
+
+
+static Py_ssize_t _slots_layout_find(SlotsLayoutObject *layout, PyObject *key, Py_ssize_t hint) {
+    // slot index for key, trying the hinted index and identity first since
+    // kwarg names are almost always the interned slot names, in slot order
+    PyObject **names = ((PyTupleObject *)layout->names)->ob_item;
+
+    if (hint >= 0 && hint < layout->size && names[hint] == key) {
+        return hint;
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        if (names[i] == key) {
+            return i;
+        }
+    }
+
+    PyObject *index = PyDict_GetItemWithError(layout->index, key);
+    if (index == NULL) {
+        return -1;
+    }
+    return PyLong_AsSsize_t(index);
+}
+
+
+static int _slots_native_store(int kind, char *field, PyObject *value) {
+    // unboxes value into a native T_LONGLONG, T_DOUBLE or T_BOOL field, with
+    // the conversions and errors of the matching member descriptors
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can't delete numeric/char attribute");
+        return -1;
+    }
+    if (kind == T_DOUBLE) {
+        double native = PyFloat_CheckExact(value) ? PyFloat_AS_DOUBLE(value) : PyFloat_AsDouble(value);
+        if (native == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+        *(double *)field = native;
+        return 0;
+    }
+    if (kind == T_LONGLONG) {
+        long long native = PyLong_AsLongLong(value);
+        if (native == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        *(long long *)field = native;
+        return 0;
+    }
+    if (!PyBool_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "attribute value type must be bool");
+        return -1;
+    }
+    *field = value == Py_True;
+    return 0;
+}
+
+
+static PyObject* _slots_native_load(int kind, const char *field) {
+    if (kind == T_DOUBLE) {
+        return PyFloat_FromDouble(*(const double *)field);
+    }
+    if (kind == T_LONGLONG) {
+        return PyLong_FromLongLong(*(const long long *)field);
+    }
+    return PyBool_FromLong(*field);
+}
+
+
+static inline Py_ssize_t _slots_native_size(int kind) {
+    return kind == T_BOOL ? sizeof(char) : kind == T_OBJECT_EX ? sizeof(PyObject *) : 8;
+}
+
+
+static inline int _slots_layout_store(SlotsLayoutObject *layout, PyObject *instance, Py_ssize_t i, PyObject *value) {
+    if (layout->members[i]->type != T_OBJECT_EX) {
+        return _slots_native_store(layout->members[i]->type, (char *)instance + layout->offsets[i], value);
+    }
+    PyObject **slot = (PyObject **)((char *)instance + layout->offsets[i]);
+    Py_INCREF(value);
+    Py_XSETREF(*slot, value);
+    return 0;
+}
+
+
+static int _slots_layout_store_key(SlotsLayoutObject *layout, PyObject *instance, PyObject *key, PyObject *value, Py_ssize_t hint) {
+    Py_ssize_t i = _slots_layout_find(layout, key, hint);
+    if (i < 0) {
+        PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+        return -1;
+    }
+    return _slots_layout_store(layout, instance, i, value);
+}
+
+
+static void _slots_pool_free(SlotsLayoutObject *layout);
+
+
+static int _slots_layout_traverse(SlotsLayoutObject *self, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(self);
+    Py_VISIT(self->type);
+    Py_VISIT(self->names);
+    Py_VISIT(self->index);
+    Py_VISIT(self->reduce);
+    return 0;
+}
+
+
+static int _slots_layout_clear(SlotsLayoutObject *self) {
+    Py_CLEAR(self->type);
+    Py_CLEAR(self->names);
+    Py_CLEAR(self->index);
+    Py_CLEAR(self->reduce);
+    return 0;
+}
+
+
+static void _slots_layout_dealloc(SlotsLayoutObject *self) {
+    PyObject_GC_UnTrack(self);
+    _slots_layout_clear(self);
+    PyMem_Free(self->offsets);
+    PyMem_Free(self->members);
+    PyMem_Free(self->order);
+    _slots_pool_free(self);
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject *)self);
+    Py_DECREF(type);
+}
+
+
+static PyMemberDef _slots_layout_members[] = {
+    {"names", T_OBJECT, offsetof(SlotsLayoutObject, names), READONLY, NULL},
+    {"direct", T_BOOL, offsetof(SlotsLayoutObject, direct), READONLY, NULL},
+    {"pool", T_PYSSIZET, offsetof(SlotsLayoutObject, pool_size), READONLY, NULL},
+    {"pooled", T_PYSSIZET, offsetof(SlotsLayoutObject, pooled), READONLY, NULL},
+    {"packed", T_BOOL, offsetof(SlotsLayoutObject, packed), READONLY, NULL},
+    {"schema", T_ULONGLONG, offsetof(SlotsLayoutObject, schema), READONLY, NULL},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_layout_slots[] = {
+    {Py_tp_doc, "slot names and member offsets for a type generated by type_factory"},
+    {Py_tp_traverse, _slots_layout_traverse},
+    {Py_tp_clear, _slots_layout_clear},
+    {Py_tp_dealloc, _slots_layout_dealloc},
+    {Py_tp_members, _slots_layout_members},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsLayoutSpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.SlotsLayout",
+    .basicsize = sizeof(SlotsLayoutObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | SLOTS_TPFLAGS_IMMUTABLE | SLOTS_TPFLAGS_NO_NEW,
+    .slots = _slots_layout_slots,
+};
+
+
+static int _slots_storage_base(PyTypeObject *type) {
+    // instances hold nothing but the object header and slots of their own:
+    // the base is object, or packed storage of native fields directly on it
+    PyTypeObject *base = type->tp_base;
+    if (base == &PyBaseObject_Type) {
+        return 1;
+    }
+    SlotsFactoryState *state = _slots_state_find();
+    return (
+        state != NULL
+        && PyType_HasFeature(base, Py_TPFLAGS_HEAPTYPE)
+        && base->tp_base == &PyBaseObject_Type
+        && PyDict_GetItemWithError(base->tp_dict, state->slots_packed) != NULL
+    );
+}
+
+
+static PyMemberDef* _slots_layout_member(PyTypeObject *type, PyObject *name) {
+    // the member behind a plain object slot of type, or a field of its packed
+    // or compiled storage. NULL, maybe with an exception, for anything else
+    PyObject *descr = PyDict_GetItemWithError(type->tp_dict, name);
+    if (descr != NULL) {
+        if (
+            Py_TYPE(descr) == &PyMemberDescr_Type
+            && ((PyMemberDescrObject *)descr)->d_member->type == T_OBJECT_EX
+        ) {
+            return ((PyMemberDescrObject *)descr)->d_member;
+        }
+        return NULL;
+    }
+    if (PyErr_Occurred() || type->tp_base == &PyBaseObject_Type || !_slots_storage_base(type)) {
+        return NULL;
+    }
+
+    descr = PyDict_GetItemWithError(type->tp_base->tp_dict, name);
+    if (descr == NULL || Py_TYPE(descr) != &PyMemberDescr_Type) {
+        return NULL;
+    }
+    PyMemberDef *member = ((PyMemberDescrObject *)descr)->d_member;
+    switch (member->type) {
+        case T_OBJECT_EX:
+        case T_LONGLONG:
+        case T_DOUBLE:
+        case T_BOOL:
+            return member;
+    }
+    return NULL;
+}
+
+
+static void _slots_schema_update(unsigned long long *schema, const char *data, Py_ssize_t size) {
+    // FNV-1a, stable across processes unlike str hashes
+    for (Py_ssize_t i=0; i<size; i++) {
+        *schema = (*schema ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+}
+
+
+static int _slots_layout_schema(SlotsLayoutObject *layout) {
+    // hash of the qualified type name and the name and kind of each slot,
+    // written ahead of encoded records so mismatched readers fail fast
+    layout->schema = 0xcbf29ce484222325ULL;
+    PyObject *qualname = ((PyHeapTypeObject *)layout->type)->ht_qualname;
+    for (Py_ssize_t i=-1; i<layout->size; i++) {
+        Py_ssize_t size;
+        const char *name = PyUnicode_AsUTF8AndSize(i < 0 ? qualname : PyTuple_GET_ITEM(layout->names, i), &size);
+        if (name == NULL) {
+            return -1;
+        }
+        char kind = i < 0 || layout->members[i] == NULL ? 0 : (char)layout->members[i]->type;
+        _slots_schema_update(&layout->schema, name, size);
+        _slots_schema_update(&layout->schema, &kind, 1);
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_registry_forget(PyObject *key, PyObject *ref) {
+    // weakref callback dropping the (schema, serial) entry of a dead type
+    SlotsFactoryState *state = _slots_state_find();
+    PyObject *types = state == NULL || state->registry == NULL
+        ? NULL : PyDict_GetItemWithError(state->registry, PyTuple_GET_ITEM(key, 0));
+    if (types != NULL && PyDict_GetItemWithError(types, PyTuple_GET_ITEM(key, 1)) == ref) {
+        Py_INCREF(types);
+        int result = PyDict_DelItem(types, PyTuple_GET_ITEM(key, 1));
+        if (result == 0 && PyDict_GET_SIZE(types) == 0) {
+            result = PyDict_DelItem(state->registry, PyTuple_GET_ITEM(key, 0));
+        }
+        Py_DECREF(types);
+        if (result == -1) {
+            return NULL;
+        }
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyMethodDef _slots_registry_forget_def = {
+    "_slots_registry_forget", (PyCFunction)_slots_registry_forget, METH_O, NULL
+};
+
+
+static int _slots_registry_add(SlotsLayoutObject *layout) {
+    // weakly maps the schema of the layout, then its serial, to its type,
+    // for unpickling instances of types that can't be imported by name.
+    // types share a schema whenever their qualname and slots match
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return -1;
+    }
+    layout->serial = ++state->serial;
+    PyObject *schema = PyLong_FromUnsignedLongLong(layout->schema);
+    PyObject *serial = PyLong_FromUnsignedLongLong(layout->serial);
+    PyObject *key = schema == NULL || serial == NULL ? NULL : PyTuple_Pack(2, schema, serial);
+    PyObject *forget = key == NULL ? NULL : PyCFunction_New(&_slots_registry_forget_def, key);
+    PyObject *ref = forget == NULL ? NULL : PyWeakref_NewRef((PyObject *)layout->type, forget);
+    PyObject *types = ref == NULL ? NULL : PyDict_GetItemWithError(state->registry, schema);
+    int result = -1;
+    if (types != NULL) {
+        result = PyDict_SetItem(types, serial, ref);
+    } else if (ref != NULL && !PyErr_Occurred() && (types = PyDict_New()) != NULL) {
+        result = PyDict_SetItem(types, serial, ref) == -1 ? -1 : PyDict_SetItem(state->registry, schema, types);
+        Py_DECREF(types);
+    }
+    Py_XDECREF(schema);
+    Py_XDECREF(serial);
+    Py_XDECREF(key);
+    Py_XDECREF(forget);
+    Py_XDECREF(ref);
+    return result;
+}
+
+
+static PyObject* _slots_registry_find(PyObject *key) {
+    // new reference to the type a (schema, name, names[, (nonce, serial)])
+    // reduce key names: the very type when this interpreter built it and is
+    // still alive, else the one live type of that schema. NULL without an
+    // exception when there is none, and ValueError when there are several
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    PyObject *types = PyDict_GetItemWithError(state->registry, PyTuple_GET_ITEM(key, 0));
+    if (types == NULL) {
+        return NULL;
+    }
+    PyObject *token = PyTuple_GET_SIZE(key) == 4 ? PyTuple_GET_ITEM(key, 3) : NULL;
+    if (token != NULL && PyTuple_Check(token) && PyTuple_GET_SIZE(token) == 2) {
+        unsigned long long nonce = PyLong_AsUnsignedLongLong(PyTuple_GET_ITEM(token, 0));
+        if (nonce == (unsigned long long)-1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        PyObject *ref = nonce == state->nonce ? PyDict_GetItemWithError(types, PyTuple_GET_ITEM(token, 1)) : NULL;
+        PyObject *type = ref == NULL ? NULL : PyObject_CallObject(ref, NULL);
+        if (type != Py_None && (type != NULL || PyErr_Occurred())) {
+            return type;
+        }
+        Py_XDECREF(type);
+    }
+
+    // types is kept alive by the candidates while the weakrefs are called
+    Py_INCREF(types);
+    PyObject *found = NULL, *serial, *ref;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(types, &pos, &serial, &ref)) {
+        PyObject *type = PyObject_CallObject(ref, NULL);
+        if (type == NULL) {
+            Py_CLEAR(found);
+            break;
+        }
+        if (type == Py_None || type == found) {
+            Py_DECREF(type);
+            continue;
+        }
+        if (found != NULL) {
+            Py_DECREF(type);
+            Py_CLEAR(found);
+            PyErr_Format(
+                PyExc_ValueError, "more than one type has the schema of %R, pickle one that can be imported by name", key
+            );
+            break;
+        }
+        found = type;
+    }
+    Py_DECREF(types);
+    return found;
+}
+
+
+static unsigned long long _slots_registry_nonce(void) {
+    // 0 with an exception when the system has no randomness to give
+    unsigned long long nonce = 0;
+    PyObject *os = PyImport_ImportModule("os");
+    PyObject *bytes = os == NULL ? NULL : PyObject_CallMethod(os, "urandom", "n", (Py_ssize_t)sizeof(nonce));
+    if (bytes != NULL && PyBytes_Check(bytes) && PyBytes_GET_SIZE(bytes) == sizeof(nonce)) {
+        memcpy(&nonce, PyBytes_AS_STRING(bytes), sizeof(nonce));
+    }
+    Py_XDECREF(os);
+    Py_XDECREF(bytes);
+    return nonce;
+}
+
+
+static PyObject* _slots_factory_layout(PyObject *self, PyObject *arg) {
+    if (!PyType_Check(arg)) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_layout() argument must be a type");
+    }
+    PyTypeObject *type = (PyTypeObject *)arg;
+
+    PyObject *__slots__ = PyObject_GetAttrString((PyObject *)type, "__slots__");
+    if (__slots__ == NULL) {
+        return NULL;
+    }
+    PyObject *items = PyUnicode_Check(__slots__)
+        ? PyTuple_Pack(1, __slots__)
+        : PySequence_Fast(__slots__, "__slots__ must be iterable");
+    Py_DECREF(__slots__);
+    if (items == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(items);
+    PyObject *names = PyTuple_New(size);
+    if (names == NULL) {
+        Py_DECREF(items);
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<size; i++) {
+        PyObject *name = PySequence_Fast_GET_ITEM(items, i);
+        if (!PyUnicode_Check(name)) {
+            Py_DECREF(items);
+            Py_DECREF(names);
+            return PyErr_Format(PyExc_TypeError, "__slots__ items must be strings");
+        }
+        Py_INCREF(name);
+        PyUnicode_InternInPlace(&name);
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    Py_DECREF(items);
+
+    SlotsFactoryState *state = _slots_state();
+    SlotsLayoutObject *layout = state == NULL ? NULL : PyObject_GC_New(SlotsLayoutObject, state->layout_type);
+    if (layout == NULL) {
+        Py_DECREF(names);
+        return NULL;
+    }
+    Py_INCREF(type);
+    layout->type = type;
+    layout->names = names;
+    layout->size = size;
+    layout->direct = 1;
+    layout->packed = 0;
+    layout->order = NULL;
+    layout->norder = 0;
+    layout->hash = -1;
+    layout->reduce = NULL;
+    layout->serial = 0;
+    layout->lazy = 0;
+    layout->pool = NULL;
+    layout->pool_size = 0;
+    layout->pooled = 0;
+    memset(&layout->stats, 0, sizeof(layout->stats));
+    layout->index = PyDict_New();
+    layout->offsets = PyMem_Calloc(layout->size ? layout->size : 1, sizeof(Py_ssize_t));
+    layout->members = PyMem_Calloc(layout->size ? layout->size : 1, sizeof(PyMemberDef *));
+
+    if (layout->index == NULL || layout->offsets == NULL || layout->members == NULL) {
+        Py_DECREF(layout);
+        return PyErr_NoMemory();
+    }
+
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        PyObject *name = PyTuple_GET_ITEM(names, i);
+        PyObject *index = PyLong_FromSsize_t(i);
+        if (index == NULL || PyDict_SetItem(layout->index, name, index) == -1) {
+            Py_XDECREF(index);
+            Py_DECREF(layout);
+            return NULL;
+        }
+        Py_DECREF(index);
+
+        // anything other than a plain object slot on the type itself, or a
+        // native field of its packed storage, (mangled names, inherited
+        // slots) falls back to PyObject_SetAttr
+        PyMemberDef *member = _slots_layout_member(type, name);
+        if (member != NULL) {
+            layout->offsets[i] = member->offset;
+            layout->members[i] = member;
+            layout->packed |= member->type != T_OBJECT_EX;
+        } else if (PyErr_Occurred()) {
+            Py_DECREF(layout);
+            return NULL;
+        } else {
+            layout->direct = 0;
+        }
+    }
+
+    if (_slots_layout_schema(layout) == -1 || _slots_registry_add(layout) == -1) {
+        Py_DECREF(layout);
+        return NULL;
+    }
+    PyObject_GC_Track(layout);
+    return (PyObject *)layout;
+}
+
+
+static inline PyObject* _slots_layout_load(SlotsLayoutObject *layout, PyObject *instance, Py_ssize_t i) {
+    // new reference to slot i, through getattr (and its AttributeError) when
+    // the slot is unset, boxed for native fields
+    if (layout->members[i]->type != T_OBJECT_EX) {
+        return _slots_native_load(layout->members[i]->type, (const char *)instance + layout->offsets[i]);
+    }
+    PyObject *value = *(PyObject **)((char *)instance + layout->offsets[i]);
+    if (value == NULL) {
+        return PyObject_GetAttr(instance, PyTuple_GET_ITEM(layout->names, i));
+    }
+    Py_INCREF(value);
+    return value;
+}
+
+
+static SlotsLayoutObject* _slots_compare_layout(SlotsFactoryState *state, PyObject *self) {
+    // layout of self when its slots can be read by offset
+    SlotsLayoutObject *layout = _slots_layout_in(state, Py_TYPE(self));
+    return layout != NULL && layout->direct ? layout : NULL;
+}
+
+
+static SlotsLayoutObject* _slots_compare_peer(SlotsFactoryState *state, SlotsLayoutObject *layout, PyObject *other) {
+    // layout of other when it shares the slot names of layout, in order
+    SlotsLayoutObject *peer = _slots_compare_layout(state, other);
+    if (peer == NULL || peer == layout) {
+        return peer;
+    }
+    if (peer->size != layout->size) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        if (PyTuple_GET_ITEM(peer->names, i) != PyTuple_GET_ITEM(layout->names, i)) {
+            return NULL;
+        }
+    }
+    return peer;
+}
+
+
+static PyObject* _slots_compare_names(PyObject *self) {
+    // slot names of self, for instances without a readable layout
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(self));
+    if (layout != NULL) {
+        Py_INCREF(layout->names);
+        return layout->names;
+    }
+    PyObject *__slots__ = PyObject_GetAttrString(self, "__slots__");
+    if (__slots__ == NULL) {
+        return NULL;
+    }
+    PyObject *names = PyUnicode_Check(__slots__)
+        ? PyTuple_Pack(1, __slots__)
+        : PySequence_Tuple(__slots__);
+    Py_DECREF(__slots__);
+    return names;
+}
+
+
+static PyObject* _slots_getattr(PyObject *instance, PyObject *names, Py_ssize_t i) {
+    return PyObject_GetAttr(instance, PyTuple_GET_ITEM(names, i));
+}
+
+
+static int _slots_compare_eq(PyObject *self, PyObject *other) {
+    // 1 when other has the same number of attributes and every slot of self
+    // compares equal to the attribute of the same name on other, 0 when not,
+    // -1 on error and -2 when other has no length to compare
+    SlotsFactoryState *state = _slots_state_find();
+    SlotsLayoutObject *layout = _slots_compare_layout(state, self);
+    SlotsLayoutObject *peer = layout != NULL ? _slots_compare_peer(state, layout, other) : NULL;
+
+    if (peer != NULL) {
+        for (Py_ssize_t i=0; i<layout->size; i++) {
+            PyObject *left = NULL, *right = NULL;
+            if (layout->members[i]->type == T_OBJECT_EX && peer->members[i]->type == T_OBJECT_EX) {
+                left = *(PyObject **)((char *)self + layout->offsets[i]);
+                right = *(PyObject **)((char *)other + peer->offsets[i]);
+            }
+            // native fields are boxed, and unset slots go through getattr,
+            // which computes lazy ones
+            if (left == NULL || right == NULL) {
+                left = _slots_layout_load(layout, self, i);
+                right = left != NULL ? _slots_layout_load(peer, other, i) : NULL;
+                int result = right == NULL ? -1 : PyObject_RichCompareBool(left, right, Py_EQ);
+                Py_XDECREF(left);
+                Py_XDECREF(right);
+                if (result == -1 && PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                    PyErr_Clear();
+                    return 0;
+                }
+                if (result != 1) {
+                    return result;
+                }
+                continue;
+            }
+            if (left == right) {
+                continue;
+            }
+            int result = PyObject_RichCompareBool(left, right, Py_EQ);
+            if (result != 1) {
+                return result;
+            }
+        }
+        return 1;
+    }
+
+    PyObject *names = _slots_compare_names(self);
+    if (names == NULL) {
+        return -1;
+    }
+    Py_ssize_t size = PyObject_Size(other);
+    if (size == -1) {
+        Py_DECREF(names);
+        if (PyErr_ExceptionMatches(PyExc_TypeError)) {
+            PyErr_Clear();
+            return -2;
+        }
+        return -1;
+    }
+
+    int result = size == PyTuple_GET_SIZE(names);
+    for (Py_ssize_t i=0; result == 1 && i<PyTuple_GET_SIZE(names); i++) {
+        PyObject *left = _slots_getattr(self, names, i);
+        PyObject *right = left != NULL ? _slots_getattr(other, names, i) : NULL;
+        if (right == NULL) {
+            Py_XDECREF(left);
+            if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                PyErr_Clear();
+                result = 0;
+            } else {
+                result = -1;
+            }
+            break;
+        }
+        result = PyObject_RichCompareBool(left, right, Py_EQ);
+        Py_DECREF(left);
+        Py_DECREF(right);
+    }
+    Py_DECREF(names);
+    return result;
+}
+
+
+static SlotsLayoutObject* _slots_order_layout(PyObject *self) {
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(self));
+    if (layout == NULL || layout->order == NULL) {
+        PyErr_Format(PyExc_TypeError, "%.200s has no order", Py_TYPE(self)->tp_name);
+        return NULL;
+    }
+    return layout;
+}
+
+
+static int _slots_compare_order(PyObject *self, PyObject *other, int op) {
+    // one lexicographic pass over the order fields: the first pair that
+    // differs decides with op, AttributeError for unset or missing fields.
+    // when every order field matches, <= and >= fall back to == unless the
+    // order already covered each slot of a same-shaped peer
+    SlotsLayoutObject *layout = _slots_order_layout(self);
+    if (layout == NULL) {
+        return -1;
+    }
+    SlotsLayoutObject *direct = layout->direct ? layout : NULL;
+    SlotsLayoutObject *peer = direct != NULL ? _slots_compare_peer(_slots_state_find(), direct, other) : NULL;
+
+    for (Py_ssize_t k=0; k<layout->norder; k++) {
+        Py_ssize_t i = layout->order[k];
+        PyObject *left = direct != NULL
+            ? _slots_layout_load(direct, self, i)
+            : _slots_getattr(self, layout->names, i);
+        if (left == NULL) {
+            return -1;
+        }
+        PyObject *right = peer != NULL
+            ? _slots_layout_load(peer, other, i)
+            : _slots_getattr(other, layout->names, i);
+        if (right == NULL) {
+            Py_DECREF(left);
+            return -1;
+        }
+
+        int result = left == right ? 1 : PyObject_RichCompareBool(left, right, Py_EQ);
+        if (result == 0) {
+            result = PyObject_RichCompareBool(left, right, op);
+        } else if (result == 1) {
+            result = -2;
+        }
+        Py_DECREF(left);
+        Py_DECREF(right);
+        if (result != -2) {
+            return result;
+        }
+    }
+
+    if (op == Py_LT || op == Py_GT) {
+        return 0;
+    }
+    if (peer != NULL && layout->norder == layout->size) {
+        return 1;
+    }
+    int result = _slots_compare_eq(self, other);
+    return result == -2 ? 0 : result;
+}
+
+
+static PyObject* _slots_compare_result(int result) {
+    if (result == -1) {
+        return NULL;
+    }
+    if (result == -2) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return PyBool_FromLong(result);
+}
+
+
+static PyObject* _slots_object_eq(PyObject *self, PyObject *other) {
+    return _slots_compare_result(_slots_compare_eq(self, other));
+}
+
+
+static PyObject* _slots_object_lt(PyObject *self, PyObject *other) {
+    return _slots_compare_result(_slots_compare_order(self, other, Py_LT));
+}
+
+
+static PyObject* _slots_object_le(PyObject *self, PyObject *other) {
+    return _slots_compare_result(_slots_compare_order(self, other, Py_LE));
+}
+
+
+static PyObject* _slots_object_gt(PyObject *self, PyObject *other) {
+    return _slots_compare_result(_slots_compare_order(self, other, Py_GT));
+}
+
+
+static PyObject* _slots_object_ge(PyObject *self, PyObject *other) {
+    return _slots_compare_result(_slots_compare_order(self, other, Py_GE));
+}
+
+
+static PyObject* _slots_object_sort_key(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    // the order fields as a tuple, so sorting by key compares tuples in C
+    // instead of walking both instances on every comparison
+    SlotsLayoutObject *layout = _slots_order_layout(self);
+    if (layout == NULL) {
+        return NULL;
+    }
+    PyObject *key = PyTuple_New(layout->norder);
+    if (key == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t k=0; k<layout->norder; k++) {
+        Py_ssize_t i = layout->order[k];
+        PyObject *value = layout->direct
+            ? _slots_layout_load(layout, self, i)
+            : _slots_getattr(self, layout->names, i);
+        if (value == NULL) {
+            Py_DECREF(key);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(key, k, value);
+    }
+    return key;
+}
+
+
+static Py_hash_t _slots_object_tp_hash(PyObject *self) {
+    // hashing is determined by the attribute names, cached on the layout
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(self));
+    if (layout != NULL) {
+        if (layout->hash == -1) {
+            layout->hash = PyObject_Hash(layout->names);
+        }
+        return layout->hash;
+    }
+
+    PyObject *names = _slots_compare_names(self);
+    if (names == NULL) {
+        return -1;
+    }
+    Py_hash_t hash = PyObject_Hash(names);
+    Py_DECREF(names);
+    return hash;
+}
+
+
+static PyObject* _slots_object_hash(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    Py_hash_t hash = _slots_object_tp_hash(self);
+    return hash == -1 ? NULL : PyLong_FromSsize_t(hash);
+}
+
+
+static PyObject* _slots_object_field(PyObject *self, SlotsLayoutObject *layout, PyObject *names, Py_ssize_t i) {
+    return layout != NULL && layout->direct
+        ? _slots_layout_load(layout, self, i)
+        : _slots_getattr(self, names, i);
+}
+
+
+static PyObject* _slots_object_export(PyObject *self, int as_dict, int deep);
+
+
+static PyObject* _slots_asdict_value(PyObject *value) {
+    // value with nested instances turned into dicts, through lists, tuples
+    // and dict values
+    if (_slots_layout_of(Py_TYPE(value)) != NULL) {
+        return _slots_object_export(value, 1, 1);
+    }
+    int list = PyList_CheckExact(value);
+    if (!list && !PyTuple_CheckExact(value) && !PyDict_CheckExact(value)) {
+        Py_INCREF(value);
+        return value;
+    }
+    if (Py_EnterRecursiveCall(" in asdict")) {
+        return NULL;
+    }
+
+    PyObject *result;
+    if (PyDict_CheckExact(value)) {
+        result = PyDict_New();
+        PyObject *key, *item;
+        Py_ssize_t pos = 0;
+        while (result != NULL && PyDict_Next(value, &pos, &key, &item)) {
+            PyObject *converted = _slots_asdict_value(item);
+            if (converted == NULL || PyDict_SetItem(result, key, converted) == -1) {
+                Py_CLEAR(result);
+            }
+            Py_XDECREF(converted);
+        }
+    } else {
+        Py_ssize_t size = Py_SIZE(value);
+        result = list ? PyList_New(size) : PyTuple_New(size);
+        for (Py_ssize_t i=0; result != NULL && i<size; i++) {
+            PyObject *converted = _slots_asdict_value(
+                list ? PyList_GET_ITEM(value, i) : PyTuple_GET_ITEM(value, i)
+            );
+            if (converted == NULL) {
+                Py_CLEAR(result);
+            } else if (list) {
+                PyList_SET_ITEM(result, i, converted);
+            } else {
+                PyTuple_SET_ITEM(result, i, converted);
+            }
+        }
+    }
+    Py_LeaveRecursiveCall();
+    return result;
+}
+
+
+static PyObject* _slots_object_export(PyObject *self, int as_dict, int deep) {
+    // the fields of self in iteration order (order, or slot order), as a
+    // dict keyed by name or as a tuple
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(self));
+    PyObject *names = _slots_compare_names(self);
+    if (names == NULL) {
+        return NULL;
+    }
+    Py_ssize_t size = layout != NULL && layout->order != NULL ? layout->norder : PyTuple_GET_SIZE(names);
+    PyObject *result = as_dict ? _PyDict_NewPresized(size) : PyTuple_New(size);
+    if (result == NULL || (deep && Py_EnterRecursiveCall(" in asdict"))) {
+        Py_XDECREF(result);
+        Py_DECREF(names);
+        return NULL;
+    }
+
+    for (Py_ssize_t k=0; k<size; k++) {
+        Py_ssize_t i = layout != NULL && layout->order != NULL ? layout->order[k] : k;
+        PyObject *value = _slots_object_field(self, layout, names, i);
+        if (value != NULL && deep) {
+            Py_SETREF(value, _slots_asdict_value(value));
+        }
+        if (value == NULL) {
+            Py_CLEAR(result);
+            break;
+        }
+        if (!as_dict) {
+            PyTuple_SET_ITEM(result, k, value);
+            continue;
+        }
+        int error = PyDict_SetItem(result, PyTuple_GET_ITEM(names, i), value);
+        Py_DECREF(value);
+        if (error == -1) {
+            Py_CLEAR(result);
+            break;
+        }
+    }
+    if (deep) {
+        Py_LeaveRecursiveCall();
+    }
+    Py_DECREF(names);
+    return result;
+}
+
+
+static PyObject* _slots_object_to_dict(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    return _slots_object_export(self, 1, 0);
+}
+
+
+static PyObject* _slots_object_to_tuple(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    return _slots_object_export(self, 0, 0);
+}
+
+
+static PyObject* _slots_object_asdict(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    return _slots_object_export(self, 1, 1);
+}
+
+
+static PyObject* _slots_reduce_key(SlotsLayoutObject *layout) {
+    // borrowed: the type itself when pickle can import it by name, otherwise
+    // (schema, name, names, (nonce, serial)) to find or rebuild it by in the
+    // loading process
+    if (layout->reduce != NULL) {
+        return layout->reduce;
+    }
+    PyTypeObject *type = layout->type;
+    PyObject *found;
+    PyObject *module_name = PyDict_GetItemString(type->tp_dict, "__module__");
+    PyObject *module = module_name == NULL || !PyUnicode_Check(module_name) ? NULL : PyImport_GetModule(module_name);
+    PyObject *dot = module == NULL ? NULL : PyUnicode_FromString(".");
+    PyObject *path = dot == NULL ? NULL : PyUnicode_Split(((PyHeapTypeObject *)type)->ht_qualname, dot, -1);
+    Py_XDECREF(dot);
+    found = path == NULL ? NULL : module;
+    Py_XINCREF(found);
+    for (Py_ssize_t i=0; found != NULL && path != NULL && i<PyList_GET_SIZE(path); i++) {
+        Py_SETREF(found, PyObject_GetAttr(found, PyList_GET_ITEM(path, i)));
+    }
+    PyErr_Clear();
+    Py_XDECREF(module);
+    Py_XDECREF(path);
+
+    if (found == (PyObject *)type) {
+        layout->reduce = found;
+        return found;
+    }
+    Py_XDECREF(found);
+    SlotsFactoryState *state = _slots_state();
+    layout->reduce = state == NULL ? NULL : Py_BuildValue(
+        "(KOO(KK))", layout->schema, ((PyHeapTypeObject *)type)->ht_name, layout->names,
+        state->nonce, layout->serial
+    );
+    return layout->reduce;
+}
+
+
+static PyObject* _slots_object_reduce_ex(PyObject *self, PyObject *protocol) {
+    // (rebuild, (key, values)) with the slots as a positional tuple. packed
+    // types pickled with protocol 5 hand their native fields over as a
+    // PickleBuffer instead, which may travel out of band
+    SlotsLayoutObject *layout = _slots_compare_layout(_slots_state_find(), self);
+    if (layout == NULL || Py_TYPE(self) != layout->type) {
+        return PyObject_CallMethod((PyObject *)&PyBaseObject_Type, "__reduce_ex__", "OO", self, protocol);
+    }
+    long version = PyLong_AsLong(protocol);
+    if (version == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    PyObject *key = _slots_reduce_key(layout);
+    if (key == NULL) {
+        return NULL;
+    }
+    int buffered = layout->packed && version >= 5;
+
+    PyObject *values = PyTuple_New(layout->size);
+    PyObject *unset = PyList_New(0);
+    if (values == NULL || unset == NULL) {
+        goto error;
+    }
+    Py_ssize_t n = 0;
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        int kind = layout->members[i]->type;
+        if (buffered && kind != T_OBJECT_EX) {
+            continue;
+        }
+        PyObject *value = kind == T_OBJECT_EX
+            ? *(PyObject **)((char *)self + layout->offsets[i])
+            : NULL;
+        if (kind != T_OBJECT_EX) {
+            value = _slots_native_load(kind, (char *)self + layout->offsets[i]);
+            if (value == NULL) {
+                goto error;
+            }
+        } else if (value == NULL) {
+            PyObject *index = PyLong_FromSsize_t(n);
+            if (index == NULL || PyList_Append(unset, index) == -1) {
+                Py_XDECREF(index);
+                goto error;
+            }
+            Py_DECREF(index);
+            value = Py_None;
+            Py_INCREF(value);
+        } else {
+            Py_INCREF(value);
+        }
+        PyTuple_SET_ITEM(values, n++, value);
+    }
+    if (n < layout->size && _PyTuple_Resize(&values, n) == -1) {
+        goto error;
+    }
+
+    PyObject *args;
+    if (buffered) {
+        PyObject *buffer = PyPickleBuffer_FromObject(self);
+        args = buffer == NULL ? NULL : PyList_GET_SIZE(unset)
+            ? Py_BuildValue("(OOON)", key, buffer, values, PyList_AsTuple(unset))
+            : PyTuple_Pack(3, key, buffer, values);
+        Py_XDECREF(buffer);
+    } else {
+        args = PyList_GET_SIZE(unset)
+            ? Py_BuildValue("(OON)", key, values, PyList_AsTuple(unset))
+            : PyTuple_Pack(2, key, values);
+    }
+    Py_DECREF(values);
+    Py_DECREF(unset);
+    SlotsFactoryState *state = _slots_state();
+    if (args == NULL || state == NULL) {
+        Py_XDECREF(args);
+        return NULL;
+    }
+    return Py_BuildValue("(ON)", buffered ? state->rebuild_packed : state->rebuild, args);
+
+error:
+    Py_XDECREF(values);
+    Py_XDECREF(unset);
+    return NULL;
+}
+
+
+static PyObject* _slots_object_reduce(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    PyObject *protocol = PyLong_FromLong(2);
+    PyObject *result = protocol == NULL ? NULL : _slots_object_reduce_ex(self, protocol);
+    Py_XDECREF(protocol);
+    return result;
+}
+
+
+static PyObject* _slots_object_replace(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames);
+static PyObject* _slots_object_copy(PyObject *self, PyObject *unused);
+static PyObject* _slots_object_deepcopy(PyObject *self, PyObject *memo);
+
+
+static PyMethodDef _slots_object_methods[] = {
+    {"__eq__", (PyCFunction)_slots_object_eq, METH_O, "equal when both attributes and values match"},
+    {"__hash__", (PyCFunction)_slots_object_hash, METH_NOARGS, "hashing is determined by the attribute names"},
+    {"__lt__", (PyCFunction)_slots_object_lt, METH_O, "lexicographic < over the fields in order"},
+    {"__le__", (PyCFunction)_slots_object_le, METH_O, "lexicographic <= over the fields in order"},
+    {"__gt__", (PyCFunction)_slots_object_gt, METH_O, "lexicographic > over the fields in order"},
+    {"__ge__", (PyCFunction)_slots_object_ge, METH_O, "lexicographic >= over the fields in order"},
+    {"sort_key", (PyCFunction)_slots_object_sort_key, METH_NOARGS, "the fields in order as a tuple, for sorted(items, key=type.sort_key)"},
+    {"to_dict", (PyCFunction)_slots_object_to_dict, METH_NOARGS, "the fields as a dict, same as dict(instance)"},
+    {"to_tuple", (PyCFunction)_slots_object_to_tuple, METH_NOARGS, "the field values as a tuple, in the order of iteration"},
+    {"asdict", (PyCFunction)_slots_object_asdict, METH_NOARGS, "to_dict, applied to nested instances in fields, lists, tuples and dicts too"},
+    {"__reduce__", (PyCFunction)_slots_object_reduce, METH_NOARGS, "helper for pickle, rebuilding from the slots as a tuple"},
+    {"__reduce_ex__", (PyCFunction)_slots_object_reduce_ex, METH_O, "helper for pickle, with the packed fields as a PickleBuffer from protocol 5"},
+    {"replace", (PyCFunction)(void(*)(void))_slots_object_replace, METH_FASTCALL | METH_KEYWORDS, "a copy with the given fields changed, recomputing the dependents that read them"},
+    {"__copy__", (PyCFunction)_slots_object_copy, METH_NOARGS, "a shallow copy, sharing the field values"},
+    {"__deepcopy__", (PyCFunction)_slots_object_deepcopy, METH_O, "a copy with copy.deepcopy applied to the field values"},
+    {NULL}
+};
+
+
+static inline int _slots_object_method_slotted(PyMethodDef *def) {
+    // installing the method has to go through setattr, which fills in the
+    // type slot (tp_richcompare or tp_hash) behind its name
+    PyCFunction meth = def->ml_meth;
+    return (
+        meth == (PyCFunction)_slots_object_eq || meth == (PyCFunction)_slots_object_hash
+        || meth == (PyCFunction)_slots_object_lt || meth == (PyCFunction)_slots_object_le
+        || meth == (PyCFunction)_slots_object_gt || meth == (PyCFunction)_slots_object_ge
+    );
+}
+
+
+static PyObject* _slots_object_method_names(void) {
+    Py_ssize_t size = 0;
+    while (_slots_object_methods[size].ml_name != NULL) {
+        size++;
+    }
+    PyObject *names = PyTuple_New(size);
+    for (Py_ssize_t i=0; names != NULL && i<size; i++) {
+        PyObject *name = PyUnicode_InternFromString(_slots_object_methods[i].ml_name);
+        if (name == NULL) {
+            Py_CLEAR(names);
+            break;
+        }
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    return names;
+}
+
+
+static PyObject* _slots_factory_methods(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_methods", nargs, 3) == -1) {
+        return NULL;
+    }
+    if (!PyType_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_methods() argument 1 must be a type");
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+    PyObject *names = args[1];
+    PyObject *order = args[2];
+
+    SlotsLayoutObject *layout = _slots_layout_of(type);
+    if (layout == NULL) {
+        return PyErr_Format(PyExc_TypeError, "%.200s has no __slots_layout__", type->tp_name);
+    }
+
+    if (order != Py_None) {
+        PyObject *items = PySequence_Fast(order, "order must be iterable");
+        if (items == NULL) {
+            return NULL;
+        }
+        Py_ssize_t size = PySequence_Fast_GET_SIZE(items);
+        Py_ssize_t *indices = PyMem_Calloc(size ? size : 1, sizeof(Py_ssize_t));
+        if (indices == NULL) {
+            Py_DECREF(items);
+            return PyErr_NoMemory();
+        }
+        for (Py_ssize_t k=0; k<size; k++) {
+            PyObject *name = PySequence_Fast_GET_ITEM(items, k);
+            PyObject *index = PyDict_GetItemWithError(layout->index, name);
+            if (index == NULL) {
+                if (!PyErr_Occurred()) {
+                    PyErr_Format(PyExc_AttributeError, "order names %R, which is not an attribute", name);
+                }
+                PyMem_Free(indices);
+                Py_DECREF(items);
+                return NULL;
+            }
+            indices[k] = PyLong_AsSsize_t(index);
+        }
+        Py_DECREF(items);
+        PyMem_Free(layout->order);
+        layout->order = indices;
+        layout->norder = size;
+    }
+
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    PyMethodDef *def = _slots_object_methods;
+    for (Py_ssize_t i=0; def->ml_name != NULL; i++, def++) {
+        PyObject *name = PyTuple_GET_ITEM(state->method_names, i);
+        int result = PySequence_Contains(names, name);
+        if (result == 1) {
+            PyObject *descr = PyDescr_NewMethod(type, def);
+            if (descr == NULL) {
+                result = -1;
+            } else if (_slots_object_method_slotted(def)) {
+                result = PyObject_SetAttr((PyObject *)type, name, descr);
+            } else {
+                // no type slot to update, which is most of what setattr
+                // costs. the type is modified once, below
+                result = PyDict_SetItem(type->tp_dict, name, descr);
+            }
+            Py_XDECREF(descr);
+            // assigning __hash__ routes hash() through a method lookup and
+            // call, the slot can point at the function directly
+            if (result == 0 && def->ml_meth == (PyCFunction)_slots_object_hash) {
+                type->tp_hash = _slots_object_tp_hash;
+            }
+        }
+        if (result == -1) {
+            PyType_Modified(type);
+            return NULL;
+        }
+    }
+    PyType_Modified(type);
+    Py_RETURN_NONE;
+}
+
+
+// the member table of a heap type follows its type object, the same place
+// CPython's own clear_slots() reads it from
+#define SLOTS_HEAPTYPE_MEMBERS(type) \
+    ((PyMemberDef *)((char *)(type) + Py_TYPE(type)->tp_basicsize))
+
+
+static void _slots_pool_dealloc(PyObject *self);
+
+
+static inline SlotsLayoutObject* _slots_pool_layout(PyTypeObject *type) {
+    SlotsFactoryState *state = _slots_state_find();
+    if (state == NULL) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = state->pool_last;
+    if (layout == NULL || layout->type != type) {
+        layout = _slots_layout_of(type);
+        if (layout != NULL && layout->pool != NULL) {
+            state->pool_last = layout;
+        }
+    }
+    return layout;
+}
+
+
+static PyObject* _slots_pool_alloc(PyTypeObject *type, Py_ssize_t nitems) {
+    // recycles a pooled instance of exactly this type, zeroed on the way in
+    SlotsLayoutObject *layout = _slots_pool_layout(type);
+    if (layout == NULL || layout->pooled == 0 || nitems != 0) {
+        return PyType_GenericAlloc(type, nitems);
+    }
+    PyObject *self = layout->pool[--layout->pooled];
+    PyObject_Init(self, type);
+    if (PyType_IS_GC(type)) {
+        PyObject_GC_Track(self);
+    }
+    return self;
+}
+
+
+static void _slots_pool_release(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+
+    // subclasses keep subtype_dealloc, which clears their own slots and then
+    // hands over to the pooled base for its slots and the memory
+    PyTypeObject *base = type;
+    while (base->tp_dealloc != _slots_pool_dealloc) {
+        base = base->tp_base;
+    }
+    // the storage base, compiled ones included, holds the fields ahead of
+    // the slots and has no dealloc of its own on this path
+    for (PyTypeObject *owner = base; owner != &PyBaseObject_Type; owner = owner->tp_base) {
+        PyMemberDef *member = SLOTS_HEAPTYPE_MEMBERS(owner);
+        for (Py_ssize_t i=0; i<Py_SIZE(owner); i++, member++) {
+            if (member->type == T_OBJECT_EX && !(member->flags & READONLY)) {
+                Py_CLEAR(*(PyObject **)((char *)self + member->offset));
+            }
+        }
+    }
+
+    SlotsLayoutObject *layout = type == base ? _slots_pool_layout(type) : NULL;
+    if (layout != NULL && layout->pooled < layout->pool_size) {
+        // zeroed past the header like a fresh allocation, packed fields
+        // included, so the next instance sees none of this one's values
+        memset((char *)self + sizeof(PyObject), 0, type->tp_basicsize - sizeof(PyObject));
+        layout->pool[layout->pooled++] = self;
+    } else {
+        type->tp_free(self);
+    }
+    // heap types are referenced by their instances
+    Py_DECREF(type);
+}
+
+
+static void _slots_pool_dealloc(PyObject *self) {
+    // the trashcan chains objects through their GC header, untracked types
+    // have none
+    if (!PyType_IS_GC(Py_TYPE(self))) {
+        _slots_pool_release(self);
+        return;
+    }
+    PyObject_GC_UnTrack(self);
+    Py_TRASHCAN_BEGIN(self, _slots_pool_dealloc)
+    _slots_pool_release(self);
+    Py_TRASHCAN_END
+}
+
+
+static void _slots_pool_free(SlotsLayoutObject *layout) {
+    SlotsFactoryState *state = _slots_state_find();
+    if (state != NULL && state->pool_last == layout) {
+        state->pool_last = NULL;
+    }
+    while (layout->pooled) {
+        layout->pool_free(layout->pool[--layout->pooled]);
+    }
+    PyMem_Free(layout->pool);
+    layout->pool = NULL;
+    layout->pool_size = 0;
+}
+
+
+static PyObject* _slots_factory_pool(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_pool", nargs, 2) == -1) {
+        return NULL;
+    }
+    if (!PyType_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_pool() argument 1 must be a type");
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+    Py_ssize_t size = PyLong_AsSsize_t(args[1]);
+    if (size == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+
+    SlotsLayoutObject *layout = _slots_layout_of(type);
+    if (layout == NULL) {
+        return PyErr_Format(PyExc_TypeError, "%.200s has no __slots_layout__", type->tp_name);
+    }
+    if (size < 1) {
+        return PyErr_Format(PyExc_ValueError, "pool must be a positive int, not %zd", size);
+    }
+    // recycled memory holds nothing but the object header and the slots
+    if (
+        !layout->direct || layout->pool != NULL || !_slots_storage_base(type)
+        || type->tp_dictoffset || type->tp_weaklistoffset
+        || type->tp_finalize != NULL || type->tp_del != NULL
+    ) {
+        return PyErr_Format(
+            PyExc_TypeError, "%.200s can't be pooled, it needs plain __slots__ and no __del__",
+            type->tp_name
+        );
+    }
+
+    layout->pool = PyMem_Calloc(size, sizeof(PyObject *));
+    if (layout->pool == NULL) {
+        return PyErr_NoMemory();
+    }
+    layout->pool_size = size;
+    layout->pool_free = type->tp_free;
+    type->tp_alloc = _slots_pool_alloc;
+    type->tp_dealloc = _slots_pool_dealloc;
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_factory_untracked(PyObject *self, PyObject *arg) {
+    // instances of a heap type are only GC tracked because of its flag, they
+    // can be left to refcounting before the first one is allocated
+    if (!PyType_Check(arg)) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_untracked() argument must be a type");
+    }
+    PyTypeObject *type = (PyTypeObject *)arg;
+
+    SlotsLayoutObject *layout = _slots_layout_of(type);
+    if (
+        layout == NULL || layout->pool != NULL || !_slots_storage_base(type)
+        || type->tp_dictoffset || type->tp_weaklistoffset
+    ) {
+        return PyErr_Format(
+            PyExc_TypeError, "%.200s can't be untracked, it needs plain __slots__",
+            type->tp_name
+        );
+    }
+    if (PyType_IS_GC(type)) {
+        type->tp_flags &= ~Py_TPFLAGS_HAVE_GC;
+        type->tp_free = PyObject_Del;
+        PyType_Modified(type);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static inline char _slots_native_format(int kind) {
+    return kind == T_BOOL ? '?' : kind == T_DOUBLE ? 'd' : 'q';
+}
+
+
+static PyTypeObject* _slots_storage_of(PyTypeObject *type) {
+    // the packed storage type in the bases of type, NULL if there is none
+    SlotsFactoryState *state = _slots_state_find();
+    for (; state != NULL && type != NULL && type != &PyBaseObject_Type; type = type->tp_base) {
+        if (
+            type->tp_base == &PyBaseObject_Type
+            && PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE)
+            && PyDict_GetItemWithError(type->tp_dict, state->slots_packed) != NULL
+        ) {
+            return type;
+        }
+    }
+    return NULL;
+}
+
+
+static Py_ssize_t _slots_storage_size(PyTypeObject *type) {
+    // struct_size of the packed storage of type, -1 with an exception without one
+    PyTypeObject *storage = _slots_storage_of(type);
+    PyObject *size = storage == NULL ? NULL : PyDict_GetItemWithError(storage->tp_dict, _slots_state_find()->struct_size);
+    if (size == NULL) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(PyExc_TypeError, "%.200s has no packed fields", type->tp_name);
+        }
+        return -1;
+    }
+    return PyLong_AsSsize_t(size);
+}
+
+
+static int _slots_storage_getbuffer(PyObject *instance, Py_buffer *view, int flags) {
+    // read only view of the native fields, laid out as struct_format
+    Py_ssize_t size = _slots_storage_size(Py_TYPE(instance));
+    if (size == -1) {
+        view->obj = NULL;
+        return -1;
+    }
+    return PyBuffer_FillInfo(view, instance, (char *)instance + sizeof(PyObject), size, 1, flags);
+}
+
+
+static PyObject* _slots_factory_storage(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // a base type holding the native fields, named by the keys of fields and
+    // typed by its values (int, float or bool), for a packed type to derive from
+    if (
+        _slots_factory_nargs("_slots_factory_storage", nargs, 1) == -1
+        || _slots_factory_dict_arg("_slots_factory_storage", args, 0) == -1
+    ) {
+        return NULL;
+    }
+    PyObject *fields = args[0];
+    Py_ssize_t size = PyDict_GET_SIZE(fields);
+
+    char *format = NULL;
+    PyObject *names = PyTuple_New(size);
+    PyMemberDef *members = PyMem_Calloc(size + 1, sizeof(PyMemberDef));
+    if (names == NULL || members == NULL) {
+        Py_XDECREF(names);
+        PyMem_Free(members);
+        return members == NULL ? PyErr_NoMemory() : NULL;
+    }
+
+    // fields in definition order, aligned as a native struct of them would
+    // be, so the block after the object header is the record of struct_format
+    format = PyMem_Malloc(size + 2);
+    if (format == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    format[0] = '@';
+    format[size + 1] = '\0';
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, i = 0, offset = sizeof(PyObject);
+    while (PyDict_Next(fields, &pos, &key, &value)) {
+        int kind;
+        if (value == (PyObject *)&PyBool_Type) {
+            kind = T_BOOL;
+        } else if (value == (PyObject *)&PyLong_Type) {
+            kind = T_LONGLONG;
+        } else if (value == (PyObject *)&PyFloat_Type) {
+            kind = T_DOUBLE;
+        } else {
+            PyErr_Format(PyExc_TypeError, "packed fields must be int, float or bool, not %R", value);
+            goto error;
+        }
+        if (!PyUnicode_Check(key)) {
+            PyErr_Format(PyExc_TypeError, "packed field names must be strings");
+            goto error;
+        }
+        // the names outlive the members through __slots_packed__
+        const char *name = PyUnicode_AsUTF8(key);
+        if (name == NULL) {
+            goto error;
+        }
+        Py_ssize_t width = _slots_native_size(kind);
+        offset = (offset + width - 1) / width * width;
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(names, i, key);
+        members[i].name = (char *)name;
+        members[i].type = kind;
+        members[i].offset = offset;
+        format[i + 1] = _slots_native_format(kind);
+        offset += width;
+        i++;
+    }
+    PyObject *struct_size = PyLong_FromSsize_t(offset - sizeof(PyObject));
+    PyObject *struct_format = PyUnicode_FromString(format);
+    PyMem_Free(format);
+    format = NULL;
+    if (struct_size == NULL || struct_format == NULL) {
+        Py_XDECREF(struct_size);
+        Py_XDECREF(struct_format);
+        goto error;
+    }
+    offset = (offset + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+
+    PyType_Slot slots[] = {
+        {Py_tp_members, members},
+        {Py_tp_doc, "native field storage for a packed dataslots type"},
+#if PY_VERSION_HEX >= 0x03090000
+        {Py_bf_getbuffer, _slots_storage_getbuffer},
+#endif
+        {0, NULL},
+    };
+    PyType_Spec spec = {
+        "slots_factory.PackedStorage",
+        (int)offset,
+        0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+        slots,
+    };
+    PyObject *type = PyType_FromSpec(&spec);
+    PyMem_Free(members);
+#if PY_VERSION_HEX < 0x03090000
+    // Py_bf_getbuffer is only a spec slot from 3.9 on, before that the buffer
+    // procs of the heap type are set directly, for subclasses to inherit
+    if (type != NULL) {
+        ((PyHeapTypeObject *)type)->as_buffer.bf_getbuffer = _slots_storage_getbuffer;
+    }
+#endif
+    SlotsFactoryState *state = _slots_state();
+    if (
+        type == NULL || state == NULL
+        || PyObject_SetAttr(type, state->slots_packed, names) == -1
+        || PyObject_SetAttr(type, state->struct_format, struct_format) == -1
+        || PyObject_SetAttr(type, state->struct_size, struct_size) == -1
+    ) {
+        Py_XDECREF(type);
+        type = NULL;
+    }
+    Py_DECREF(names);
+    Py_DECREF(struct_format);
+    Py_DECREF(struct_size);
+    return type;
+
+error:
+    Py_DECREF(names);
+    PyMem_Free(members);
+    PyMem_Free(format);
+    return NULL;
+}
+
+
+static int _slots_factory_check(SlotsLayoutObject *layout, PyObject *instance, PyObject *kwargs) {
+    Py_ssize_t size;
+
+    if (layout != NULL) {
+        size = layout->size;
+    } else {
+        PyObject *__slots__ = PyObject_GetAttrString(instance, "__slots__");
+        if (__slots__ == NULL) {
+            return -1;
+        }
+        size = PyObject_Length(__slots__);
+        Py_DECREF(__slots__);
+    }
+    if (size != PyDict_GET_SIZE(kwargs)) {
+        PyErr_Format(PyExc_AttributeError, "Mismatch in number of attributes");
+        return -1;
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_factory_setattrs_slim(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // positional fastcall only, parsing keywords would need an intermediate dict
+
+    if (
+        _slots_factory_nargs("_slots_factory_setattrs_slim", nargs, 3) == -1
+        || _slots_factory_dict_arg("_slots_factory_setattrs_slim", args, 1) == -1
+    ) {
+        return NULL;
+    }
+
+    PyObject *instance = args[0];
+    PyObject *kwargs = args[1];
+    int check_flag = PyObject_IsTrue(args[2]);
+    if (check_flag == -1) {
+        return NULL;
+    }
+
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(instance));
+
+    if (check_flag && _slots_factory_check(layout, instance, kwargs) == -1) {
+        return NULL;
+    }
+
+    SlotsStats *stats;
+    if (_slots_stats(Py_TYPE(instance), &stats) == -1) {
+        return NULL;
+    }
+    if (stats != NULL) {
+        stats->created++;
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    if (layout != NULL && _slots_layout_direct(layout, instance)) {
+        for (Py_ssize_t i=0; PyDict_Next(kwargs, &pos, &key, &value); i++) {
+            if (_slots_layout_store_key(layout, instance, key, value, i) == -1) {
+                return NULL;
+            }
+        }
+        Py_RETURN_NONE;
+    }
+
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        if (PyObject_SetAttr(instance, key, value) == -1) {
+            return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+
+static int _slots_factory_store(SlotsLayoutObject *layout, PyObject *object, PyObject *instance, PyObject *key, PyObject *value, Py_ssize_t hint) {
+    // layout is NULL when stores can't be written directly, in which case
+    // they go through __setattr__ of the instance, or of object if given
+    int result;
+
+    if (layout != NULL) {
+        return _slots_layout_store_key(layout, instance, key, value, hint);
+    }
+    if (object == NULL) {
+        result = PyObject_SetAttr(instance, key, value);
+    } else if (object == (PyObject *)&PyBaseObject_Type) {
+        result = PyObject_GenericSetAttr(instance, key, value);
+    } else {
+        PyObject *none = PyObject_CallMethod(object, "__setattr__", "OOO", instance, key, value);
+        result = none == NULL ? -1 : 0;
+        Py_XDECREF(none);
+    }
+    if (result == -1) {
+        PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+    }
+    return result;
+}
+
+
+static int _slots_factory_apply(SlotsLayoutObject *layout, PyObject *object, PyObject *instance, PyObject *_callables, PyObject *_defaults, PyObject *kwargs, PyObject *_dependents) {
+    PyObject *key, *value;
+    Py_ssize_t pos;
+
+    // callables and defaults are skipped for the fields in kwargs
+    pos = 0;
+    while (PyDict_Next(_callables, &pos, &key, &value)) {
+        int given = PyDict_Contains(kwargs, key);
+        if (given) {
+            if (given == -1) {
+                return -1;
+            }
+            continue;
+        }
+        value = PyObject_CallObject(value, NULL);
+        if (value == NULL) {
+            return -1;
+        }
+        int result = _slots_factory_store(layout, object, instance, key, value, -1);
+        Py_DECREF(value);
+        if (result == -1) {
+            return -1;
+        }
+    }
+
+    pos = 0;
+    while (PyDict_Next(_defaults, &pos, &key, &value)) {
+        int given = PyDict_Contains(kwargs, key);
+        if (given) {
+            if (given == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (_slots_factory_store(layout, object, instance, key, value, -1) == -1) {
+            return -1;
+        }
+    }
+
+    pos = 0;
+    for (Py_ssize_t i=0; PyDict_Next(kwargs, &pos, &key, &value); i++) {
+        if (_slots_factory_store(layout, object, instance, key, value, i) == -1) {
+            return -1;
+        }
+    }
+
+    pos = 0;
+    while (PyDict_Next(_dependents, &pos, &key, &value)) {
+        value = PyObject_CallFunctionObjArgs(value, instance, NULL);
+        if (value == NULL) {
+            return -1;
+        }
+        int result = _slots_factory_store(layout, object, instance, key, value, -1);
+        Py_DECREF(value);
+        if (result == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static PyObject* _slots_factory_setattrs(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // positional fastcall only, parsing keywords would need an intermediate dict
+    if (_slots_factory_nargs("_slots_factory_setattrs", nargs, 6) == -1) {
+        return NULL;
+    }
+    for (Py_ssize_t i=1; i<5; i++) {
+        if (_slots_factory_dict_arg("_slots_factory_setattrs", args, i) == -1) {
+            return NULL;
+        }
+    }
+
+    PyObject *instance = args[0];
+    PyObject *kwargs = args[3];
+
+    int check_flag = PyObject_IsTrue(args[5]);
+    if (check_flag == -1) {
+        return NULL;
+    }
+
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(instance));
+
+    if (check_flag && _slots_factory_check(layout, instance, kwargs) == -1) {
+        return NULL;
+    }
+    if (layout != NULL && !_slots_layout_direct(layout, instance)) {
+        layout = NULL;
+    }
+
+    if (_slots_factory_apply(layout, NULL, instance, args[1], args[2], kwargs, args[4]) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_factory_from_type(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    // kwargs arrive as kwnames plus the tail of args, so no dict is built
+    if (_slots_factory_nargs("slots_from_type", nargs, 1) == -1) {
+        return NULL;
+    }
+    if (!PyType_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "slots_from_type() argument 1 must be a type");
+    }
+
+    PyObject *instance = PyObject_CallObject(args[0], NULL);
+    if (instance == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t nkwargs = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);
+    SlotsLayoutObject *layout = _slots_layout_of(Py_TYPE(instance));
+    if (layout != NULL && !_slots_layout_direct(layout, instance)) {
+        layout = NULL;
+    } else if (layout == NULL && PyErr_Occurred()) {
+        Py_DECREF(instance);
+        return NULL;
+    }
+
+    for (Py_ssize_t i=0; i<nkwargs; i++) {
+        if (_slots_factory_store(layout, NULL, instance, PyTuple_GET_ITEM(kwnames, i), args[nargs + i], i) == -1) {
+            Py_DECREF(instance);
+            return NULL;
+        }
+    }
+
+    return instance;
+}
+
+
+static PyObject* _slots_factory_setattrs_from_object(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // stores bypass the instance's __setattr__: straight into the slots when
+    // object is object and the type has a layout, otherwise through
+    // object.__setattr__
+    if (_slots_factory_nargs("_slots_factory_setattrs_from_object", nargs, 6) == -1) {
+        return NULL;
+    }
+    for (Py_ssize_t i=2; i<6; i++) {
+        if (_slots_factory_dict_arg("_slots_factory_setattrs_from_object", args, i) == -1) {
+            return NULL;
+        }
+    }
+
+    PyObject *instance = args[1];
+
+    SlotsLayoutObject *layout = NULL;
+    if (args[0] == (PyObject *)&PyBaseObject_Type) {
+        layout = _slots_layout_of(Py_TYPE(instance));
+        if (layout != NULL && !_slots_layout_owns(layout, instance)) {
+            layout = NULL;
+        } else if (layout == NULL && PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+
+    if (_slots_factory_apply(layout, args[0], instance, args[2], args[3], args[4], args[5]) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+typedef struct {
+    // a callable, or a default when factory is 0
+    PyObject *value;
+    int factory;
+} SlotsDefault;
+
+
+// the schemas slots_factory.compiler builds into extensions, which carry a
+// copy of these declarations. bump the ABI whenever any of them changes
+#define SLOTS_COMPILED_ABI 1
+#define SLOTS_COMPILED_CAPSULE "slots_factory.compiled_schema"
+
+typedef int (*SlotsCompiledStore)(int kind, char *field, PyObject *value);
+
+typedef struct {
+    int abi;
+    const char *qualname;
+    // name, member type and offset of each slot, in __slots__ order
+    Py_ssize_t size;
+    const char *const *names;
+    const int *kinds;
+    const Py_ssize_t *offsets;
+    // the storage type, with a member per slot
+    PyType_Spec *spec;
+    // stores the arguments and then the prototype of the slots left, 1 when
+    // done, 0 to leave the call to the generic path before anything is
+    // stored, -1 with an exception
+    int (*init)(
+        PyObject *self, PyObject *const *values, Py_ssize_t npositional, PyObject *kwnames,
+        const Py_ssize_t *positions, PyObject *const *names, const SlotsDefault *prototype,
+        SlotsCompiledStore store
+    );
+} SlotsCompiledSchema;
+
+
+static int _slots_compiled_matches(const SlotsCompiledSchema *schema, SlotsLayoutObject *layout) {
+    // the slots of layout are the ones schema was compiled for, with the same
+    // member types at the same offsets
+    if (schema->size != layout->size) {
+        return 0;
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        const char *name = PyUnicode_AsUTF8(PyTuple_GET_ITEM(layout->names, i));
+        if (name == NULL) {
+            PyErr_Clear();
+            return 0;
+        }
+        if (
+            strcmp(name, schema->names[i]) != 0
+            || layout->offsets[i] != schema->offsets[i]
+            || layout->members[i]->type != schema->kinds[i]
+        ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static const SlotsCompiledSchema* _slots_compiled_schema(PyObject *capsule) {
+    if (!PyCapsule_IsValid(capsule, SLOTS_COMPILED_CAPSULE)) {
+        PyErr_Format(PyExc_TypeError, "expected a compiled schema, not %.200s", Py_TYPE(capsule)->tp_name);
+        return NULL;
+    }
+    const SlotsCompiledSchema *schema = PyCapsule_GetPointer(capsule, SLOTS_COMPILED_CAPSULE);
+    if (schema->abi != SLOTS_COMPILED_ABI) {
+        PyErr_Format(
+            PyExc_ValueError, "it was compiled for schema ABI %d, this slots_factory reads %d",
+            schema->abi, SLOTS_COMPILED_ABI
+        );
+        return NULL;
+    }
+    return schema;
+}
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *callables;
+    PyObject *defaults;
+    PyObject *dependents;
+    PyObject *reads;
+    PyObject *fields;
+    PyObject *doc;
+    PyObject *dict;
+    SlotsLayoutObject *layout;
+    Py_ssize_t *positions;
+    SlotsDefault *prototype;
+    // set by _slots_factory_compiled_init, kept only while the layout bound
+    // matches it
+    const SlotsCompiledSchema *compiled;
+    PyObject *schema;
+    int frozen;
+    int positional;
+    vectorcallfunc vectorcall;
+} SlotsInitObject;
+
+
+static void _slots_init_prototype_free(SlotsDefault *prototype, Py_ssize_t size) {
+    for (Py_ssize_t i=0; i<size; i++) {
+        Py_XDECREF(prototype[i].value);
+    }
+    PyMem_Free(prototype);
+}
+
+
+static int _slots_init_prototype_add(SlotsDefault *prototype, SlotsLayoutObject *layout, PyObject *sources, int factory) {
+    // 0 when a key of sources isn't a slot of the layout
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(sources, &pos, &key, &value)) {
+        Py_ssize_t i = PyUnicode_Check(key) ? _slots_layout_find(layout, key, -1) : -1;
+        if (i < 0) {
+            return PyErr_Occurred() ? -1 : 0;
+        }
+        Py_INCREF(value);
+        Py_XSETREF(prototype[i].value, value);
+        prototype[i].factory = factory;
+    }
+    return 1;
+}
+
+
+static int _slots_init_prototype(SlotsInitObject *init, SlotsLayoutObject *layout) {
+    // the callables and defaults laid out by slot index, so instances of the
+    // layout's type can be filled in one pass without a lookup per field.
+    // left NULL when either names something that isn't a slot of the
+    // layout, which keeps the generic path
+    if (!layout->direct) {
+        return 0;
+    }
+    SlotsDefault *prototype = PyMem_Calloc(layout->size ? layout->size : 1, sizeof(SlotsDefault));
+    if (prototype == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    int result = _slots_init_prototype_add(prototype, layout, init->callables, 1);
+    if (result == 1) {
+        result = _slots_init_prototype_add(prototype, layout, init->defaults, 0);
+    }
+    if (result != 1) {
+        _slots_init_prototype_free(prototype, layout->size);
+        return result;
+    }
+    init->prototype = prototype;
+    return 0;
+}
+
+
+static int _slots_init_merge(SlotsInitObject *init, SlotsLayoutObject *layout, PyObject *instance, PyObject *const *values, Py_ssize_t npositional, PyObject *kwnames, SlotsStats *stats) {
+    // writes each slot of instance once, from the arguments when given and
+    // from the prototype otherwise, so factories only run for missing fields
+    Py_ssize_t nkwargs = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);
+    char given[64];
+    char *supplied = layout->size <= (Py_ssize_t)sizeof(given) ? given : PyMem_Malloc(layout->size);
+    if (supplied == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(supplied, 0, layout->size);
+
+    int result = -1;
+    for (Py_ssize_t i=0; i<npositional + nkwargs; i++) {
+        Py_ssize_t j = i < npositional
+            ? init->positions[i]
+            : _slots_layout_find(layout, PyTuple_GET_ITEM(kwnames, i - npositional), i - npositional);
+        if (j < 0) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+            }
+            goto done;
+        }
+        if (_slots_layout_store(layout, instance, j, values[i]) == -1) {
+            goto done;
+        }
+        supplied[j] = 1;
+    }
+
+    for (Py_ssize_t j=0; j<layout->size; j++) {
+        PyObject *value = init->prototype[j].value;
+        if (value == NULL || supplied[j]) {
+            continue;
+        }
+        if (!init->prototype[j].factory) {
+            if (_slots_layout_store(layout, instance, j, value) == -1) {
+                goto done;
+            }
+            continue;
+        }
+        long long start = stats == NULL ? 0 : _slots_stats_now();
+        value = PyObject_CallObject(value, NULL);
+        if (stats != NULL) {
+            stats->callables_ns += _slots_stats_now() - start;
+        }
+        if (value == NULL) {
+            goto done;
+        }
+        int stored = _slots_layout_store(layout, instance, j, value);
+        Py_DECREF(value);
+        if (stored == -1) {
+            goto done;
+        }
+    }
+    result = 0;
+
+done:
+    if (supplied != given) {
+        PyMem_Free(supplied);
+    }
+    return result;
+}
+
+
+static int _slots_init_bind(SlotsInitObject *init, SlotsLayoutObject *layout) {
+    // slot index of each field, used as the lookup hint for positionals
+    Py_ssize_t nfields = PyTuple_GET_SIZE(init->fields);
+    for (Py_ssize_t i=0; i<nfields; i++) {
+        init->positions[i] = _slots_layout_find(layout, PyTuple_GET_ITEM(init->fields, i), i);
+        if (init->positions[i] < 0 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    if (_slots_init_prototype(init, layout) == -1) {
+        return -1;
+    }
+    if (init->compiled != NULL && !_slots_compiled_matches(init->compiled, layout)) {
+        init->compiled = NULL;
+    }
+    Py_INCREF(layout);
+    init->layout = layout;
+    return 0;
+}
+
+
+static SlotsLayoutObject* _slots_init_layout(SlotsInitObject *init, PyObject *instance) {
+    // layout of the instance's type, when stores can be written directly.
+    // the first type seen is kept on the init, which only ever belongs to one
+    SlotsLayoutObject *layout = init->layout;
+
+    if (layout == NULL || layout->type != Py_TYPE(instance)) {
+        layout = _slots_layout_of(Py_TYPE(instance));
+        if (layout == NULL) {
+            return NULL;
+        }
+        int result = 0;
+        SLOTS_BEGIN_CRITICAL_SECTION(init);
+        if (init->layout == NULL) {
+            result = _slots_init_bind(init, layout);
+        }
+        SLOTS_END_CRITICAL_SECTION();
+        if (result == -1) {
+            return NULL;
+        }
+    }
+    if (init->frozen) {
+        return _slots_layout_owns(layout, instance) ? layout : NULL;
+    }
+    return _slots_layout_direct(layout, instance) ? layout : NULL;
+}
+
+
+static Py_ssize_t _slots_init_field(SlotsInitObject *init, PyObject *key, Py_ssize_t npositional) {
+    // index of key among the first npositional fields, -1 if it isn't one
+    PyObject **fields = ((PyTupleObject *)init->fields)->ob_item;
+
+    for (Py_ssize_t i=0; i<npositional; i++) {
+        if (fields[i] == key) {
+            return i;
+        }
+    }
+    for (Py_ssize_t i=0; i<npositional; i++) {
+        if (PyUnicode_Compare(fields[i], key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static int _slots_init_given(SlotsInitObject *init, PyObject *key, Py_ssize_t npositional, PyObject *kwnames) {
+    // 1 when the call passes key, positionally or by keyword
+    if (_slots_init_field(init, key, npositional) >= 0) {
+        return 1;
+    }
+    Py_ssize_t nkwargs = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);
+    for (Py_ssize_t i=0; i<nkwargs; i++) {
+        if (PyTuple_GET_ITEM(kwnames, i) == key) {
+            return 1;
+        }
+    }
+    for (Py_ssize_t i=0; i<nkwargs; i++) {
+        if (PyUnicode_Compare(PyTuple_GET_ITEM(kwnames, i), key) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static int _slots_init_store(SlotsInitObject *init, SlotsLayoutObject *layout, PyObject *instance, PyObject *key, PyObject *value, Py_ssize_t hint) {
+    return _slots_factory_store(
+        layout, init->frozen ? (PyObject *)&PyBaseObject_Type : NULL, instance, key, value, hint
+    );
+}
+
+
+static int _slots_init_run(SlotsInitObject *init, PyObject *instance, PyObject *const *values, Py_ssize_t npositional, PyObject *kwnames) {
+    // values holds npositional field values followed by one value per kwname
+    Py_ssize_t nkwargs = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);
+
+    if (npositional > 0) {
+        if (npositional > PyTuple_GET_SIZE(init->fields)) {
+            PyErr_Format(
+                PyExc_TypeError, "__init__() takes at most %zd positional arguments (%zd given)",
+                PyTuple_GET_SIZE(init->fields), npositional
+            );
+            return -1;
+        }
+        for (Py_ssize_t i=0; i<nkwargs; i++) {
+            PyObject *key = PyTuple_GET_ITEM(kwnames, i);
+            if (_slots_init_field(init, key, npositional) >= 0) {
+                PyErr_Format(PyExc_TypeError, "__init__() got multiple values for argument '%U'", key);
+                return -1;
+            }
+        }
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos;
+    long long start;
+
+    SlotsLayoutObject *layout = _slots_init_layout(init, instance);
+    if (layout == NULL && PyErr_Occurred()) {
+        return -1;
+    }
+    SlotsStats *stats;
+    if (_slots_stats(Py_TYPE(instance), &stats) == -1) {
+        return -1;
+    }
+
+    if (layout != NULL && layout == init->layout && init->prototype != NULL) {
+        // compiled stores are only timed as a whole, counted calls keep the
+        // generic path
+        int done = 0;
+        if (init->compiled != NULL && stats == NULL) {
+            done = init->compiled->init(
+                instance, values, npositional, kwnames, init->positions,
+                PySequence_Fast_ITEMS(layout->names), init->prototype, _slots_native_store
+            );
+        }
+        if (done == -1 || (!done && _slots_init_merge(init, layout, instance, values, npositional, kwnames, stats) == -1)) {
+            return -1;
+        }
+    } else {
+        // callables and defaults are skipped for the fields passed in
+        pos = 0;
+        while (PyDict_Next(init->callables, &pos, &key, &value)) {
+            if (_slots_init_given(init, key, npositional, kwnames)) {
+                continue;
+            }
+            start = stats == NULL ? 0 : _slots_stats_now();
+            value = PyObject_CallObject(value, NULL);
+            if (stats != NULL) {
+                stats->callables_ns += _slots_stats_now() - start;
+            }
+            if (value == NULL) {
+                return -1;
+            }
+            int result = _slots_init_store(init, layout, instance, key, value, -1);
+            Py_DECREF(value);
+            if (result == -1) {
+                return -1;
+            }
+        }
+
+        pos = 0;
+        while (PyDict_Next(init->defaults, &pos, &key, &value)) {
+            if (_slots_init_given(init, key, npositional, kwnames)) {
+                continue;
+            }
+            if (_slots_init_store(init, layout, instance, key, value, -1) == -1) {
+                return -1;
+            }
+        }
+
+        for (Py_ssize_t i=0; i<npositional; i++) {
+            PyObject *field = PyTuple_GET_ITEM(init->fields, i);
+            if (_slots_init_store(init, layout, instance, field, values[i], init->positions[i]) == -1) {
+                return -1;
+            }
+        }
+
+        for (Py_ssize_t i=0; i<nkwargs; i++) {
+            if (_slots_init_store(init, layout, instance, PyTuple_GET_ITEM(kwnames, i), values[npositional + i], i) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    pos = 0;
+    while (PyDict_Next(init->dependents, &pos, &key, &value)) {
+        start = stats == NULL ? 0 : _slots_stats_now();
+        value = PyObject_CallFunctionObjArgs(value, instance, NULL);
+        if (stats != NULL) {
+            stats->dependents_ns += _slots_stats_now() - start;
+        }
+        if (value == NULL) {
+            return -1;
+        }
+        int result = _slots_init_store(init, layout, instance, key, value, -1);
+        Py_DECREF(value);
+        if (result == -1) {
+            return -1;
+        }
+    }
+
+    if (stats != NULL) {
+        stats->created++;
+        stats->frozen += init->frozen;
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_init_vectorcall(SlotsInitObject *init, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+    Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+
+    if (nargs < 1) {
+        return PyErr_Format(PyExc_TypeError, "__init__() missing required argument 'self'");
+    }
+    if (nargs > 1 && !init->positional) {
+        return PyErr_Format(PyExc_TypeError, "__init__() takes no positional arguments");
+    }
+    if (_slots_init_run(init, args[0], args + 1, nargs - 1, kwnames) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_init_descr_get(PyObject *self, PyObject *obj, PyObject *type) {
+    if (obj == NULL || obj == Py_None) {
+        Py_INCREF(self);
+        return self;
+    }
+    return PyMethod_New(self, obj);
+}
+
+
+static int _slots_init_traverse(SlotsInitObject *self, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(self);
+    Py_VISIT(self->callables);
+    Py_VISIT(self->defaults);
+    Py_VISIT(self->dependents);
+    Py_VISIT(self->reads);
+    Py_VISIT(self->fields);
+    Py_VISIT(self->dict);
+    Py_VISIT(self->layout);
+    Py_VISIT(self->schema);
+    for (Py_ssize_t i=0; self->prototype != NULL && i<self->layout->size; i++) {
+        Py_VISIT(self->prototype[i].value);
+    }
+    return 0;
+}
+
+
+static int _slots_init_clear(SlotsInitObject *self) {
+    if (self->prototype != NULL) {
+        SlotsDefault *prototype = self->prototype;
+        self->prototype = NULL;
+        _slots_init_prototype_free(prototype, self->layout->size);
+    }
+    Py_CLEAR(self->callables);
+    Py_CLEAR(self->defaults);
+    Py_CLEAR(self->dependents);
+    Py_CLEAR(self->reads);
+    Py_CLEAR(self->fields);
+    Py_CLEAR(self->dict);
+    Py_CLEAR(self->layout);
+    self->compiled = NULL;
+    Py_CLEAR(self->schema);
+    return 0;
+}
+
+
+static void _slots_init_dealloc(SlotsInitObject *self) {
+    PyObject_GC_UnTrack(self);
+    _slots_init_clear(self);
+    Py_CLEAR(self->doc);
+    PyMem_Free(self->positions);
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject *)self);
+    Py_DECREF(type);
+}
+
+
+static PyMemberDef _slots_init_members[] = {
+    {"__doc__", T_OBJECT, offsetof(SlotsInitObject, doc), READONLY, NULL},
+    {"fields", T_OBJECT, offsetof(SlotsInitObject, fields), READONLY, NULL},
+    {"positional", T_BOOL, offsetof(SlotsInitObject, positional), READONLY, NULL},
+#if PY_VERSION_HEX >= 0x03090000
+    {"__vectorcalloffset__", T_PYSSIZET, offsetof(SlotsInitObject, vectorcall), READONLY, NULL},
+    {"__dictoffset__", T_PYSSIZET, offsetof(SlotsInitObject, dict), READONLY, NULL},
+#endif
+    {NULL}
+};
+
+
+static PyGetSetDef _slots_init_getset[] = {
+    {"__dict__", PyObject_GenericGetDict, PyObject_GenericSetDict, NULL, NULL},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_init_slots[] = {
+    // no Py_tp_doc, which would shadow the __doc__ member on the type
+    {Py_tp_call, PyVectorcall_Call},
+    {Py_tp_descr_get, _slots_init_descr_get},
+    {Py_tp_traverse, _slots_init_traverse},
+    {Py_tp_clear, _slots_init_clear},
+    {Py_tp_dealloc, _slots_init_dealloc},
+    {Py_tp_members, _slots_init_members},
+    {Py_tp_getset, _slots_init_getset},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsInitSpec = {
+    // native __init__ for types generated by @dataslots
+    .name = "slots_factory.tools.SlotsFactoryTools.SlotsInit",
+    .basicsize = sizeof(SlotsInitObject),
+    .flags = (
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC
+        | Py_TPFLAGS_HAVE_VECTORCALL | Py_TPFLAGS_METHOD_DESCRIPTOR
+        | SLOTS_TPFLAGS_IMMUTABLE | SLOTS_TPFLAGS_NO_NEW
+    ),
+    .slots = _slots_init_slots,
+};
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *function;
+    PyObject *member;
+    PyTypeObject *type;
+    Py_ssize_t offset;
+} SlotsLazyObject;
+
+
+static PyObject* _slots_lazy_tp_new(PyTypeObject *cls, PyObject *args, PyObject *kwargs) {
+    PyObject *function;
+    if (kwargs != NULL && PyDict_GET_SIZE(kwargs)) {
+        return PyErr_Format(PyExc_TypeError, "lazy() takes no keyword arguments");
+    }
+    if (!PyArg_UnpackTuple(args, "lazy", 1, 1, &function)) {
+        return NULL;
+    }
+    if (!PyCallable_Check(function)) {
+        return PyErr_Format(PyExc_TypeError, "lazy() argument must be callable");
+    }
+    SlotsLazyObject *lazy = (SlotsLazyObject *)cls->tp_alloc(cls, 0);
+    if (lazy == NULL) {
+        return NULL;
+    }
+    Py_INCREF(function);
+    lazy->function = function;
+    return (PyObject *)lazy;
+}
+
+
+static PyObject** _slots_lazy_slot(SlotsLazyObject *lazy, PyObject *instance) {
+    // the slot of instance behind the descriptor, NULL with an exception
+    // when the descriptor is unbound or instance is of another type
+    if (lazy->type == NULL || !PyObject_TypeCheck(instance, lazy->type)) {
+        PyErr_Format(
+            PyExc_TypeError, "lazy slot for %.200s doesn't apply to a '%.200s' object",
+            lazy->type == NULL ? "no type" : lazy->type->tp_name, Py_TYPE(instance)->tp_name
+        );
+        return NULL;
+    }
+    return (PyObject **)((char *)instance + lazy->offset);
+}
+
+
+static PyObject* _slots_lazy_descr_get(SlotsLazyObject *lazy, PyObject *instance, PyObject *type) {
+    // computes the value on first access and keeps it in the slot
+    if (instance == NULL || instance == Py_None) {
+        Py_INCREF(lazy);
+        return (PyObject *)lazy;
+    }
+    PyObject **slot = _slots_lazy_slot(lazy, instance);
+    if (slot == NULL) {
+        return NULL;
+    }
+    if (*slot != NULL) {
+        Py_INCREF(*slot);
+        return *slot;
+    }
+    PyObject *value = PyObject_CallFunctionObjArgs(lazy->function, instance, NULL);
+    if (value != NULL && *slot == NULL) {
+        Py_INCREF(value);
+        *slot = value;
+    }
+    return value;
+}
+
+
+static int _slots_lazy_descr_set(SlotsLazyObject *lazy, PyObject *instance, PyObject *value) {
+    // assigning overrides the computed value, deleting resets it. deleting
+    // one never computed nor set raises, like the member it replaces
+    PyObject **slot = _slots_lazy_slot(lazy, instance);
+    if (slot == NULL) {
+        return -1;
+    }
+    if (value == NULL && *slot == NULL) {
+        PyErr_SetObject(PyExc_AttributeError, PyDescr_NAME(lazy->member));
+        return -1;
+    }
+    Py_XINCREF(value);
+    Py_XSETREF(*slot, value);
+    return 0;
+}
+
+
+static int _slots_lazy_traverse(SlotsLazyObject *lazy, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(lazy);
+    Py_VISIT(lazy->function);
+    Py_VISIT(lazy->member);
+    Py_VISIT(lazy->type);
+    return 0;
+}
+
+
+static int _slots_lazy_clear(SlotsLazyObject *lazy) {
+    Py_CLEAR(lazy->function);
+    Py_CLEAR(lazy->member);
+    Py_CLEAR(lazy->type);
+    return 0;
+}
+
+
+static void _slots_lazy_dealloc(SlotsLazyObject *lazy) {
+    PyObject_GC_UnTrack(lazy);
+    _slots_lazy_clear(lazy);
+    PyTypeObject *type = Py_TYPE(lazy);
+    type->tp_free((PyObject *)lazy);
+    Py_DECREF(type);
+}
+
+
+static PyMemberDef _slots_lazy_members[] = {
+    {"function", T_OBJECT, offsetof(SlotsLazyObject, function), READONLY, NULL},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_lazy_slots[] = {
+    {Py_tp_doc, "lazy(function): a dependent field computed by function(self) on first access, then kept in its slot"},
+    {Py_tp_new, _slots_lazy_tp_new},
+    {Py_tp_descr_get, _slots_lazy_descr_get},
+    {Py_tp_descr_set, _slots_lazy_descr_set},
+    {Py_tp_traverse, _slots_lazy_traverse},
+    {Py_tp_clear, _slots_lazy_clear},
+    {Py_tp_dealloc, _slots_lazy_dealloc},
+    {Py_tp_members, _slots_lazy_members},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsLazySpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.LazySlot",
+    .basicsize = sizeof(SlotsLazyObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | SLOTS_TPFLAGS_IMMUTABLE,
+    .slots = _slots_lazy_slots,
+};
+
+
+static PyObject* _slots_factory_lazy(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // replaces the member descriptors of the object slots named by the keys
+    // of lazies with LazySlots computing them from the values
+    if (
+        _slots_factory_nargs("_slots_factory_lazy", nargs, 2) == -1
+        || _slots_factory_dict_arg("_slots_factory_lazy", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    if (!PyType_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_lazy() argument 1 must be a type");
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(args[1], &pos, &key, &value)) {
+        PyObject *member = PyDict_GetItemWithError(type->tp_dict, key);
+        if (member == NULL && !PyErr_Occurred() && type->tp_base != &PyBaseObject_Type && _slots_storage_base(type)) {
+            // the slots of compiled types are members of their storage
+            member = PyDict_GetItemWithError(type->tp_base->tp_dict, key);
+        }
+        if (
+            member == NULL || Py_TYPE(member) != &PyMemberDescr_Type
+            || ((PyMemberDescrObject *)member)->d_member->type != T_OBJECT_EX
+        ) {
+            return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_TypeError, "lazy field %R must be an object slot", key);
+        }
+        PyObject *function = Py_TYPE(value) == state->lazy_type ? ((SlotsLazyObject *)value)->function : value;
+        SlotsLazyObject *lazy = (SlotsLazyObject *)state->lazy_type->tp_alloc(state->lazy_type, 0);
+        if (lazy == NULL) {
+            return NULL;
+        }
+        Py_INCREF(function);
+        lazy->function = function;
+        Py_INCREF(member);
+        lazy->member = member;
+        Py_INCREF(type);
+        lazy->type = type;
+        lazy->offset = ((PyMemberDescrObject *)member)->d_member->offset;
+        int result = PyObject_SetAttr((PyObject *)type, key, (PyObject *)lazy);
+        Py_DECREF(lazy);
+        if (result == -1) {
+            return NULL;
+        }
+        SlotsLayoutObject *layout = _slots_layout_of(type);
+        if (layout != NULL) {
+            layout->lazy++;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_factory_init(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_init", nargs, 7) == -1) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<3; i++) {
+        if (_slots_factory_dict_arg("_slots_factory_init", args, i) == -1) {
+            return NULL;
+        }
+    }
+    if (_slots_factory_dict_arg("_slots_factory_init", args, 6) == -1) {
+        return NULL;
+    }
+
+    PyObject *_callables = args[0];
+    PyObject *_defaults = args[1];
+    PyObject *_dependents = args[2];
+
+    int frozen = PyObject_IsTrue(args[3]);
+    if (frozen == -1) {
+        return NULL;
+    }
+
+    PyObject *fields = PySequence_Tuple(args[4]);
+    if (fields == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<PyTuple_GET_SIZE(fields); i++) {
+        if (!PyUnicode_Check(PyTuple_GET_ITEM(fields, i))) {
+            Py_DECREF(fields);
+            return PyErr_Format(PyExc_TypeError, "_slots_factory_init() fields must be strings");
+        }
+    }
+
+    int positional = PyObject_IsTrue(args[5]);
+    if (positional == -1) {
+        Py_DECREF(fields);
+        return NULL;
+    }
+
+    Py_ssize_t *positions = PyMem_Calloc(PyTuple_GET_SIZE(fields) + 1, sizeof(Py_ssize_t));
+    if (positions == NULL) {
+        Py_DECREF(fields);
+        return PyErr_NoMemory();
+    }
+
+    SlotsFactoryState *state = _slots_state();
+    SlotsInitObject *init = state == NULL ? NULL : PyObject_GC_New(SlotsInitObject, state->init_type);
+    if (init == NULL) {
+        Py_DECREF(fields);
+        PyMem_Free(positions);
+        return NULL;
+    }
+
+    Py_INCREF(_callables);
+    Py_INCREF(_defaults);
+    Py_INCREF(_dependents);
+    Py_INCREF(args[6]);
+    init->callables = _callables;
+    init->defaults = _defaults;
+    init->dependents = _dependents;
+    init->reads = args[6];
+    init->fields = fields;
+    init->dict = NULL;
+    init->layout = NULL;
+    init->positions = positions;
+    init->prototype = NULL;
+    init->compiled = NULL;
+    init->schema = NULL;
+    init->frozen = frozen;
+    init->positional = positional;
+    init->vectorcall = (vectorcallfunc)_slots_init_vectorcall;
+
+    if (frozen) {
+        init->doc = PyUnicode_InternFromString("frozen");
+    } else if (PyDict_GET_SIZE(_callables) || PyDict_GET_SIZE(_defaults) || PyDict_GET_SIZE(_dependents)) {
+        init->doc = PyUnicode_InternFromString("generic");
+    } else {
+        init->doc = PyUnicode_InternFromString("slim");
+    }
+
+    PyObject_GC_Track(init);
+    return (PyObject *)init;
+}
+
+
+static int _slots_classify_item(PyObject *const *kinds, SlotsFactoryState *state, PyObject *key, PyObject *value, int from_dict) {
+    // files value under key in one of kinds: attrs, methods, callables,
+    // dependents and lazy
+    enum {ATTRS, METHODS, CALLABLES, DEPENDENTS, LAZY} kind = ATTRS;
+    if (PyObject_TypeCheck(value, state->lazy_type)) {
+        kind = LAZY;
+    } else if (PyType_Check(value) && from_dict) {
+        kind = CALLABLES;
+    } else if (PyFunction_Check(value)) {
+        kind = METHODS;
+        PyObject *name = ((PyFunctionObject *)value)->func_name;
+        if (PyUnicode_Check(name) && PyUnicode_CompareWithASCIIString(name, "<lambda>") == 0) {
+            int argcount = ((PyCodeObject *)PyFunction_GET_CODE(value))->co_argcount;
+            if (argcount == 1) {
+                kind = DEPENDENTS;
+            } else if (argcount == 0) {
+                kind = CALLABLES;
+            } else {
+                PyErr_SetString(
+                    PyExc_SyntaxError,
+                    "lambda-type factory functions must take either 'self' as an argument, or take no arguments"
+                );
+                return -1;
+            }
+        }
+    } else {
+        int result = PyObject_IsInstance(value, (PyObject *)&PyProperty_Type);
+        if (result == -1) {
+            return -1;
+        }
+        kind = result ? METHODS : ATTRS;
+    }
+    return PyDict_SetItem(kinds[kind], key, value);
+}
+
+
+static PyObject* _slots_factory_classify(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // sorts what a class body defines, its __dict__ and then its
+    // __annotations__, into (attrs, methods, callables, dependents, lazy,
+    // defaults) for @dataslots. names in args[1] are skipped, and the first
+    // definition of a name wins
+    if (_slots_factory_nargs("_slots_factory_classify", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    PyObject *cls = args[0], *skip = args[1];
+    PyObject *kinds[6] = {NULL};
+    for (int i=0; i<6; i++) {
+        if ((kinds[i] = PyDict_New()) == NULL) {
+            goto error;
+        }
+    }
+    PyObject *attrs = kinds[0], *defaults = kinds[5];
+
+    for (int from_dict=1; from_dict>=0; from_dict--) {
+        PyObject *collection = PyObject_GetAttr(cls, from_dict ? state->class_dict : state->class_annotations);
+        if (collection == NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                goto error;
+            }
+            PyErr_Clear();
+            continue;
+        }
+        PyObject *items = PyMapping_Items(collection);
+        Py_DECREF(collection);
+        if (items == NULL) {
+            goto error;
+        }
+        for (Py_ssize_t i=0; i<PyList_GET_SIZE(items); i++) {
+            PyObject *item = PyList_GET_ITEM(items, i);
+            if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2) {
+                PyErr_SetString(PyExc_TypeError, "class items must be pairs");
+                Py_DECREF(items);
+                goto error;
+            }
+            PyObject *key = PyTuple_GET_ITEM(item, 0), *value = PyTuple_GET_ITEM(item, 1);
+            int seen = PySequence_Contains(skip, key);
+            for (int k=0; seen == 0 && k<5; k++) {
+                seen = PyDict_Contains(kinds[k], key);
+            }
+            // __hash__ = None is set by class creation when __eq__ is
+            // defined alone
+            if (
+                seen == 0 && value == Py_None && PyUnicode_Check(key)
+                && PyUnicode_CompareWithASCIIString(key, "__hash__") == 0
+            ) {
+                continue;
+            }
+            if (seen == -1 || (seen == 0 && _slots_classify_item(kinds, state, key, value, from_dict) == -1)) {
+                Py_DECREF(items);
+                goto error;
+            }
+        }
+        Py_DECREF(items);
+    }
+
+    // defaults as the class resolves them, descriptors and bases included
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(attrs, &pos, &key, &value)) {
+        PyObject *resolved = PyObject_GetAttr(cls, key);
+        if (resolved == NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                goto error;
+            }
+            PyErr_Clear();
+            continue;
+        }
+        int result = PyDict_SetItem(defaults, key, resolved);
+        Py_DECREF(resolved);
+        if (result == -1) {
+            goto error;
+        }
+    }
+
+    PyObject *result = PyTuple_New(6);
+    if (result == NULL) {
+        goto error;
+    }
+    for (int i=0; i<6; i++) {
+        PyTuple_SET_ITEM(result, i, kinds[i]);
+    }
+    return result;
+
+error:
+    for (int i=0; i<6; i++) {
+        Py_XDECREF(kinds[i]);
+    }
+    return NULL;
+}
+
+
+static PyObject* _slots_factory_compiled(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // the storage type of a compiled schema, for a type with the slots named
+    // by args[1] and the packed fields of args[2] to derive from. ValueError
+    // when the schema was compiled for other slots
+    if (
+        _slots_factory_nargs("_slots_factory_compiled", nargs, 3) == -1
+        || _slots_factory_dict_arg("_slots_factory_compiled", args, 2) == -1
+    ) {
+        return NULL;
+    }
+    const SlotsCompiledSchema *schema = _slots_compiled_schema(args[0]);
+    if (schema == NULL) {
+        return NULL;
+    }
+    PyObject *packed = args[2];
+    PyObject *slots = PySequence_Tuple(args[1]);
+    if (slots == NULL) {
+        return NULL;
+    }
+
+    char *format = NULL;
+    PyObject *names = NULL, *type = NULL;
+    Py_ssize_t size = PyTuple_GET_SIZE(slots);
+    if (size != schema->size) {
+        PyErr_Format(PyExc_ValueError, "it was compiled for %zd slots, not %zd", schema->size, size);
+        goto error;
+    }
+    for (Py_ssize_t i=0; i<size; i++) {
+        PyObject *name = PyTuple_GET_ITEM(slots, i);
+        const char *encoded = PyUnicode_Check(name) ? PyUnicode_AsUTF8(name) : NULL;
+        if (encoded == NULL) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_TypeError, "slot names must be strings");
+            }
+            goto error;
+        }
+        if (strcmp(encoded, schema->names[i]) != 0) {
+            PyErr_Format(PyExc_ValueError, "slot %zd is %R, it was compiled as '%s'", i, name, schema->names[i]);
+            goto error;
+        }
+        PyObject *value = PyDict_GetItemWithError(packed, name);
+        int kind = T_OBJECT_EX;
+        if (value == (PyObject *)&PyBool_Type) {
+            kind = T_BOOL;
+        } else if (value == (PyObject *)&PyLong_Type) {
+            kind = T_LONGLONG;
+        } else if (value == (PyObject *)&PyFloat_Type) {
+            kind = T_DOUBLE;
+        } else if (value != NULL || PyErr_Occurred()) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_TypeError, "packed fields must be int, float or bool, not %R", value);
+            }
+            goto error;
+        }
+        if (schema->kinds[i] != kind) {
+            PyErr_Format(PyExc_ValueError, "slot %R was compiled with another type", name);
+            goto error;
+        }
+    }
+
+    // the native fields come first, in the order of packed, so the block
+    // after the object header is the record of struct_format
+    Py_ssize_t npacked = PyDict_GET_SIZE(packed);
+    names = PyTuple_New(npacked);
+    format = PyMem_Malloc(npacked + 2);
+    if (names == NULL || format == NULL) {
+        if (format == NULL) {
+            PyErr_NoMemory();
+        }
+        goto error;
+    }
+    format[0] = '@';
+    format[npacked + 1] = '\0';
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, n = 0, offset = sizeof(PyObject);
+    while (PyDict_Next(packed, &pos, &key, &value)) {
+        Py_ssize_t i = 0;
+        while (i < size && PyTuple_GET_ITEM(slots, i) != key && PyUnicode_Compare(PyTuple_GET_ITEM(slots, i), key) != 0) {
+            i++;
+        }
+        if (PyErr_Occurred()) {
+            goto error;
+        }
+        if (i == size) {
+            PyErr_Format(PyExc_ValueError, "packed field %R isn't a slot", key);
+            goto error;
+        }
+        Py_ssize_t width = _slots_native_size(schema->kinds[i]);
+        offset = (offset + width - 1) / width * width;
+        if (schema->offsets[i] != offset) {
+            PyErr_Format(PyExc_ValueError, "packed field %R was compiled at another offset", key);
+            goto error;
+        }
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(names, n, key);
+        format[++n] = _slots_native_format(schema->kinds[i]);
+        offset += width;
+    }
+
+    SlotsFactoryState *state = _slots_state();
+    type = state == NULL ? NULL : PyType_FromSpec(schema->spec);
+    if (type == NULL || PyObject_SetAttr(type, state->slots_packed, names) == -1) {
+        goto error;
+    }
+    if (npacked) {
+        PyObject *struct_size = PyLong_FromSsize_t(offset - sizeof(PyObject));
+        PyObject *struct_format = PyUnicode_FromString(format);
+        int result = (
+            struct_size == NULL || struct_format == NULL
+            || PyObject_SetAttr(type, state->struct_format, struct_format) == -1
+            || PyObject_SetAttr(type, state->struct_size, struct_size) == -1
+        ) ? -1 : 0;
+        Py_XDECREF(struct_size);
+        Py_XDECREF(struct_format);
+        if (result == -1) {
+            goto error;
+        }
+        // set on the heap type, for the dataslots type to inherit
+        ((PyHeapTypeObject *)type)->as_buffer.bf_getbuffer = _slots_storage_getbuffer;
+    }
+    Py_DECREF(slots);
+    Py_DECREF(names);
+    PyMem_Free(format);
+    return type;
+
+error:
+    Py_DECREF(slots);
+    Py_XDECREF(names);
+    Py_XDECREF(type);
+    PyMem_Free(format);
+    return NULL;
+}
+
+
+static PyObject* _slots_factory_compiled_init(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // hands the stores of an __init__ to the compiled init of its schema,
+    // for as long as the layout it binds to is the compiled one
+    if (_slots_factory_nargs("_slots_factory_compiled_init", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    if (Py_TYPE(args[0]) != state->init_type) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_compiled_init() argument 1 must be a SlotsInit");
+    }
+    const SlotsCompiledSchema *schema = _slots_compiled_schema(args[1]);
+    if (schema == NULL) {
+        return NULL;
+    }
+    SlotsInitObject *init = (SlotsInitObject *)args[0];
+    PyObject *previous;
+    SLOTS_BEGIN_CRITICAL_SECTION(init);
+    previous = init->schema;
+    Py_INCREF(args[1]);
+    init->schema = args[1];
+    init->compiled = init->layout == NULL || _slots_compiled_matches(schema, init->layout) ? schema : NULL;
+    SLOTS_END_CRITICAL_SECTION();
+    Py_XDECREF(previous);
+    Py_RETURN_NONE;
+}
+
+
+static SlotsInitObject* _slots_init_of(PyObject *type) {
+    // new reference to the native __init__ of a dataslots type
+    if (!PyType_Check(type)) {
+        PyErr_Format(PyExc_TypeError, "expected a type generated by @dataslots");
+        return NULL;
+    }
+    SlotsFactoryState *state = _slots_state();
+    PyObject *init = state == NULL ? NULL : PyObject_GetAttr(type, state->init);
+    if (init == NULL) {
+        return NULL;
+    }
+    if (Py_TYPE(init) != state->init_type) {
+        Py_DECREF(init);
+        PyErr_Format(PyExc_TypeError, "expected a type generated by @dataslots");
+        return NULL;
+    }
+    return (SlotsInitObject *)init;
+}
+
+
+static inline PyObject* _slots_factory_alloc(PyTypeObject *type) {
+    // skips type_call when nothing but object.__new__ would run
+    if (type->tp_new == PyBaseObject_Type.tp_new) {
+        return type->tp_alloc(type, 0);
+    }
+    PyObject *args = PyTuple_New(0);
+    if (args == NULL) {
+        return NULL;
+    }
+    PyObject *instance = type->tp_new(type, args, NULL);
+    Py_DECREF(args);
+    return instance;
+}
+
+
+static PyObject* _slots_copy_deepcopy_function(void) {
+    // borrowed, imported on the first deep copy
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    if (state->deepcopy == NULL) {
+        PyObject *copy = PyImport_ImportModule("copy");
+        if (copy == NULL) {
+            return NULL;
+        }
+        state->deepcopy = PyObject_GetAttrString(copy, "deepcopy");
+        Py_DECREF(copy);
+    }
+    return state->deepcopy;
+}
+
+
+static SlotsLayoutObject* _slots_clone_layout(PyTypeObject *type) {
+    // borrowed layout of the nearest type in the mro of type that has one,
+    // NULL with an exception when none does
+    for (PyTypeObject *base = type; base != NULL; base = base->tp_base) {
+        SlotsLayoutObject *layout = _slots_layout_of(base);
+        if (layout != NULL || PyErr_Occurred()) {
+            return layout;
+        }
+    }
+    PyErr_Format(PyExc_TypeError, "'%.200s' object has no slots layout", type->tp_name);
+    return NULL;
+}
+
+
+static int _slots_clone_lazy(SlotsLayoutObject *layout, Py_ssize_t i) {
+    // 1 when slot i is behind a LazySlot, whose cached value may be stale
+    if (!layout->lazy) {
+        return 0;
+    }
+    PyObject *descr = PyDict_GetItemWithError(layout->type->tp_dict, PyTuple_GET_ITEM(layout->names, i));
+    SlotsFactoryState *state = _slots_state();
+    if (descr == NULL || state == NULL) {
+        return PyErr_Occurred() ? -1 : 0;
+    }
+    return Py_TYPE(descr) == state->lazy_type;
+}
+
+
+static PyObject* _slots_clone_value(PyObject *value, PyObject *memo) {
+    // steals value, returning it or its deep copy through memo
+    if (memo == NULL || value == NULL) {
+        return value;
+    }
+    PyObject *deepcopy = _slots_copy_deepcopy_function();
+    PyObject *copied = deepcopy == NULL ? NULL : PyObject_CallFunctionObjArgs(deepcopy, value, memo, NULL);
+    Py_DECREF(value);
+    return copied;
+}
+
+
+static int _slots_clone_dict(PyObject *self, PyObject *clone, PyObject *memo) {
+    // the instance dict of subclasses that have one
+    PyObject *dict = PyObject_GenericGetDict(self, NULL);
+    if (dict == NULL) {
+        return -1;
+    }
+    PyObject *copied = memo == NULL ? PyDict_Copy(dict) : _slots_clone_value(dict, memo);
+    if (memo == NULL) {
+        Py_DECREF(dict);
+    }
+    if (copied == NULL) {
+        return -1;
+    }
+    int result = PyObject_GenericSetDict(clone, copied, NULL);
+    Py_DECREF(copied);
+    return result;
+}
+
+
+static PyObject* _slots_object_clone(PyObject *self, SlotsLayoutObject *layout, PyObject *memo, int fresh) {
+    // new instance of the type of self holding the same field values, deep
+    // copies of them when memo is given. slots are copied straight across
+    // when the layout owns self, without running __init__ or __setattr__.
+    // fresh leaves out lazy values, for a clone about to have fields changed
+    PyTypeObject *type = Py_TYPE(self);
+    PyObject *clone = _slots_factory_alloc(type);
+    if (clone == NULL) {
+        return NULL;
+    }
+    if (memo != NULL) {
+        PyObject *id = PyLong_FromVoidPtr(self);
+        if (id == NULL || PyDict_SetItem(memo, id, clone) == -1) {
+            Py_XDECREF(id);
+            goto error;
+        }
+        Py_DECREF(id);
+    }
+
+    int owns = _slots_layout_owns(layout, self);
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        if (fresh) {
+            int lazy = _slots_clone_lazy(layout, i);
+            if (lazy == -1) {
+                goto error;
+            }
+            if (lazy) {
+                continue;
+            }
+        }
+        PyObject *name = PyTuple_GET_ITEM(layout->names, i);
+        if (owns) {
+            int kind = layout->members[i]->type;
+            char *field = (char *)self + layout->offsets[i];
+            if (kind != T_OBJECT_EX) {
+                memcpy((char *)clone + layout->offsets[i], field, _slots_native_size(kind));
+                continue;
+            }
+            PyObject *value = *(PyObject **)field;
+            if (value == NULL) {
+                continue;
+            }
+            Py_INCREF(value);
+            value = _slots_clone_value(value, memo);
+            if (value == NULL) {
+                goto error;
+            }
+            Py_XSETREF(*(PyObject **)((char *)clone + layout->offsets[i]), value);
+            continue;
+        }
+        PyObject *value = PyObject_GetAttr(self, name);
+        if (value == NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                goto error;
+            }
+            PyErr_Clear();
+            continue;
+        }
+        value = _slots_clone_value(value, memo);
+        int result = value == NULL ? -1 : PyObject_GenericSetAttr(clone, name, value);
+        Py_XDECREF(value);
+        if (result == -1) {
+            goto error;
+        }
+    }
+
+    if (!owns && type->tp_dictoffset != 0 && _slots_clone_dict(self, clone, memo) == -1) {
+        goto error;
+    }
+    return clone;
+
+error:
+    Py_DECREF(clone);
+    return NULL;
+}
+
+
+static int _slots_replace_dependents(SlotsInitObject *init, SlotsLayoutObject *layout, PyObject *object, PyObject *instance, PyObject *kwnames) {
+    // reruns, in dependency order, the dependents that read a changed field or
+    // a dependent that was rerun. the ones passed in kwnames are kept as given
+    PyObject *dirty = PySet_New(kwnames);
+    if (dirty == NULL) {
+        return -1;
+    }
+
+    PyObject *key, *function;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(init->dependents, &pos, &key, &function)) {
+        int stale = PySet_Contains(dirty, key);
+        if (stale == -1) {
+            goto error;
+        }
+        if (stale) {
+            continue;
+        }
+        // a dependent without recorded reads may read anything
+        PyObject *reads = PyDict_GetItemWithError(init->reads, key);
+        if (reads != NULL) {
+            PyObject *both = PyNumber_And(reads, dirty);
+            if (both == NULL) {
+                goto error;
+            }
+            stale = PyObject_IsTrue(both);
+            Py_DECREF(both);
+        } else {
+            stale = PyErr_Occurred() ? -1 : 1;
+        }
+        if (stale == -1) {
+            goto error;
+        }
+        if (!stale) {
+            continue;
+        }
+
+        PyObject *value = PyObject_CallFunctionObjArgs(function, instance, NULL);
+        if (value == NULL) {
+            goto error;
+        }
+        int result = _slots_factory_store(layout, object, instance, key, value, -1);
+        Py_DECREF(value);
+        if (result == -1 || PySet_Add(dirty, key) == -1) {
+            goto error;
+        }
+    }
+
+    Py_DECREF(dirty);
+    return 0;
+
+error:
+    Py_DECREF(dirty);
+    return -1;
+}
+
+
+static PyObject* _slots_object_replace(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+    if (nargs) {
+        return PyErr_Format(PyExc_TypeError, "replace() takes no positional arguments");
+    }
+    SlotsLayoutObject *layout = _slots_clone_layout(Py_TYPE(self));
+    if (layout == NULL) {
+        return NULL;
+    }
+    Py_ssize_t nchanges = kwnames == NULL ? 0 : PyTuple_GET_SIZE(kwnames);
+    PyObject *clone = _slots_object_clone(self, layout, NULL, nchanges > 0);
+    if (clone == NULL || nchanges == 0) {
+        return clone;
+    }
+
+    // callables and defaults are never rerun, only the fields passed and
+    // the dependents reading them are written
+    SlotsFactoryState *state = _slots_state();
+    PyObject *init = state == NULL ? NULL : PyObject_GetAttr((PyObject *)Py_TYPE(self), state->init);
+    if (init == NULL) {
+        Py_DECREF(clone);
+        return NULL;
+    }
+    if (Py_TYPE(init) != state->init_type) {
+        Py_CLEAR(init);
+    }
+    PyObject *object = init != NULL && ((SlotsInitObject *)init)->frozen ? (PyObject *)&PyBaseObject_Type : NULL;
+    SlotsLayoutObject *direct = _slots_layout_owns(layout, clone) ? layout : NULL;
+
+    for (Py_ssize_t i=0; i<nchanges; i++) {
+        if (_slots_factory_store(direct, object, clone, PyTuple_GET_ITEM(kwnames, i), args[i], i) == -1) {
+            goto error;
+        }
+    }
+    if (
+        init != NULL && PyDict_GET_SIZE(((SlotsInitObject *)init)->dependents)
+        && _slots_replace_dependents((SlotsInitObject *)init, direct, object, clone, kwnames) == -1
+    ) {
+        goto error;
+    }
+    Py_XDECREF(init);
+    return clone;
+
+error:
+    Py_XDECREF(init);
+    Py_DECREF(clone);
+    return NULL;
+}
+
+
+static PyObject* _slots_object_copy(PyObject *self, PyObject *unused) {
+    SlotsLayoutObject *layout = _slots_clone_layout(Py_TYPE(self));
+    return layout == NULL ? NULL : _slots_object_clone(self, layout, NULL, 0);
+}
+
+
+static PyObject* _slots_object_deepcopy(PyObject *self, PyObject *memo) {
+    if (!PyDict_Check(memo)) {
+        return PyErr_Format(PyExc_TypeError, "__deepcopy__() argument must be dict, not %.200s", Py_TYPE(memo)->tp_name);
+    }
+    SlotsLayoutObject *layout = _slots_clone_layout(Py_TYPE(self));
+    return layout == NULL ? NULL : _slots_object_clone(self, layout, memo, 0);
+}
+
+
+static PyObject* _slots_factory_from_rows(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_from_rows", nargs, 2) == -1) {
+        return NULL;
+    }
+
+    SlotsInitObject *init = _slots_init_of(args[0]);
+    if (init == NULL) {
+        return NULL;
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+
+    PyObject *rows = PySequence_Fast(args[1], "rows must be iterable");
+    if (rows == NULL) {
+        Py_DECREF(init);
+        return NULL;
+    }
+
+    Py_ssize_t nrows = PySequence_Fast_GET_SIZE(rows);
+    PyObject *result = PyList_New(nrows);
+    if (result == NULL) {
+        goto error;
+    }
+
+    for (Py_ssize_t i=0; i<nrows; i++) {
+        PyObject *row = PySequence_Fast(PySequence_Fast_GET_ITEM(rows, i), "rows must contain sequences");
+        if (row == NULL) {
+            goto error;
+        }
+        PyObject *instance = _slots_factory_alloc(type);
+        if (instance == NULL) {
+            Py_DECREF(row);
+            goto error;
+        }
+        PyList_SET_ITEM(result, i, instance);
+
+        int status = _slots_init_run(
+            init, instance, PySequence_Fast_ITEMS(row), PySequence_Fast_GET_SIZE(row), NULL
+        );
+        Py_DECREF(row);
+        if (status == -1) {
+            goto error;
+        }
+    }
+
+    Py_DECREF(rows);
+    Py_DECREF(init);
+    return result;
+
+error:
+    Py_XDECREF(result);
+    Py_DECREF(rows);
+    Py_DECREF(init);
+    return NULL;
+}
+
+
+static PyObject* _slots_factory_from_columns(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (
+        _slots_factory_nargs("_slots_factory_from_columns", nargs, 2) == -1
+        || _slots_factory_dict_arg("_slots_factory_from_columns", args, 1) == -1
+    ) {
+        return NULL;
+    }
+
+    SlotsInitObject *init = _slots_init_of(args[0]);
+    if (init == NULL) {
+        return NULL;
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+    PyObject *columns = args[1];
+
+    Py_ssize_t ncolumns = PyDict_GET_SIZE(columns);
+    Py_ssize_t nrows = 0;
+    PyObject *result = NULL;
+    PyObject **values = NULL;
+    PyObject *kwnames = PyTuple_New(ncolumns);
+    PyObject *sequences = PyTuple_New(ncolumns);
+    if (kwnames == NULL || sequences == NULL) {
+        goto done;
+    }
+
+    PyObject *key, *column;
+    Py_ssize_t pos = 0;
+    for (Py_ssize_t j=0; PyDict_Next(columns, &pos, &key, &column); j++) {
+        if (!PyUnicode_Check(key)) {
+            PyErr_Format(PyExc_TypeError, "column names must be strings");
+            goto done;
+        }
+        PyObject *sequence = PySequence_Fast(column, "columns must be sequences");
+        if (sequence == NULL) {
+            goto done;
+        }
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(kwnames, j, key);
+        PyTuple_SET_ITEM(sequences, j, sequence);
+
+        if (j == 0) {
+            nrows = PySequence_Fast_GET_SIZE(sequence);
+        } else if (PySequence_Fast_GET_SIZE(sequence) != nrows) {
+            PyErr_Format(PyExc_ValueError, "column '%U' has a different length", key);
+            goto done;
+        }
+    }
+
+    values = PyMem_Malloc((ncolumns + 1) * sizeof(PyObject *));
+    result = PyList_New(nrows);
+    if (values == NULL || result == NULL) {
+        if (values == NULL) {
+            PyErr_NoMemory();
+        }
+        Py_CLEAR(result);
+        goto done;
+    }
+
+    for (Py_ssize_t i=0; i<nrows; i++) {
+        PyObject *instance = _slots_factory_alloc(type);
+        if (instance == NULL) {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, i, instance);
+
+        for (Py_ssize_t j=0; j<ncolumns; j++) {
+            values[j] = PySequence_Fast_GET_ITEM(PyTuple_GET_ITEM(sequences, j), i);
+        }
+        if (_slots_init_run(init, instance, values, 0, kwnames) == -1) {
+            Py_CLEAR(result);
+            goto done;
+        }
+    }
+
+done:
+    PyMem_Free(values);
+    Py_XDECREF(kwnames);
+    Py_XDECREF(sequences);
+    Py_DECREF(init);
+    return result;
+}
+
+
+static PyObject* _slots_factory_from_dict(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // an instance initialised from the items of a dict, as if they were
+    // passed as keyword arguments but without building a kwargs dict
+    if (
+        _slots_factory_nargs("_slots_factory_from_dict", nargs, 2) == -1
+        || _slots_factory_dict_arg("_slots_factory_from_dict", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    SlotsInitObject *init = _slots_init_of(args[0]);
+    if (init == NULL) {
+        return NULL;
+    }
+    PyObject *fields = args[1];
+    Py_ssize_t size = PyDict_GET_SIZE(fields);
+
+    PyObject *instance = NULL;
+    PyObject **values = PyMem_Malloc((size + 1) * sizeof(PyObject *));
+    PyObject *kwnames = PyTuple_New(size);
+    if (values == NULL || kwnames == NULL) {
+        if (values == NULL) {
+            PyErr_NoMemory();
+        }
+        goto done;
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    for (Py_ssize_t i=0; PyDict_Next(fields, &pos, &key, &value); i++) {
+        if (!PyUnicode_Check(key)) {
+            PyErr_Format(PyExc_TypeError, "keywords must be strings");
+            goto done;
+        }
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(kwnames, i, key);
+        values[i] = value;
+    }
+
+    instance = _slots_factory_alloc((PyTypeObject *)args[0]);
+    if (instance != NULL && _slots_init_run(init, instance, values, 0, kwnames) == -1) {
+        Py_CLEAR(instance);
+    }
+
+done:
+    Py_XDECREF(kwnames);
+    PyMem_Free(values);
+    Py_DECREF(init);
+    return instance;
+}
+
+
+static PyObject* _slots_factory_from_buffer(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // an instance whose fields are copied from the struct_format record at
+    // offset in a buffer, no values are boxed along the way
+    if (_slots_factory_nargs("_slots_factory_from_buffer", nargs, 3) == -1) {
+        return NULL;
+    }
+    if (!PyType_Check(args[0])) {
+        return PyErr_Format(PyExc_TypeError, "expected a type generated by @dataslots");
+    }
+    PyTypeObject *type = (PyTypeObject *)args[0];
+    Py_ssize_t offset = PyNumber_AsSsize_t(args[2], PyExc_OverflowError);
+    if (offset == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+
+    SlotsLayoutObject *layout = _slots_layout_of(type);
+    if (layout == NULL || !layout->direct) {
+        return PyErr_Format(PyExc_TypeError, "%.200s has no direct __slots_layout__", type->tp_name);
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        if (layout->members[i]->type == T_OBJECT_EX) {
+            return PyErr_Format(
+                PyExc_TypeError, "%.200s has fields outside of its struct_format: %R",
+                type->tp_name, PyTuple_GET_ITEM(layout->names, i)
+            );
+        }
+    }
+    Py_ssize_t size = _slots_storage_size(type);
+    if (size == -1) {
+        return NULL;
+    }
+
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(args[1], &buffer, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    PyObject *instance = NULL;
+    if (offset < 0 || buffer.len - offset < size) {
+        PyErr_Format(
+            PyExc_ValueError, "from_buffer requires a buffer of at least %zd bytes at offset %zd",
+            size, offset
+        );
+    } else if ((instance = _slots_factory_alloc(type)) != NULL) {
+        memcpy((char *)instance + sizeof(PyObject), (char *)buffer.buf + offset, size);
+        for (Py_ssize_t i=0; i<layout->size; i++) {
+            if (layout->members[i]->type == T_BOOL) {
+                char *field = (char *)instance + layout->offsets[i];
+                *field = *field != 0;
+            }
+        }
+    }
+    PyBuffer_Release(&buffer);
+    return instance;
+}
+
+
+// binary codec: a record is every slot of the layout in order, written
+// without names. native fields are raw little endian values, object slots
+// a tag byte and a payload, anything without a tag of its own is pickled
+enum {
+    SLOTS_CODEC_UNSET,
+    SLOTS_CODEC_NONE,
+    SLOTS_CODEC_FALSE,
+    SLOTS_CODEC_TRUE,
+    SLOTS_CODEC_INT,
+    SLOTS_CODEC_FLOAT,
+    SLOTS_CODEC_STR,
+    SLOTS_CODEC_BYTES,
+    SLOTS_CODEC_PICKLE,
+};
+
+
+typedef struct {
+    char *data;
+    Py_ssize_t size;
+    Py_ssize_t capacity;
+} SlotsCodecWriter;
+
+
+typedef struct {
+    const unsigned char *data;
+    Py_ssize_t size;
+    Py_ssize_t pos;
+} SlotsCodecReader;
+
+
+static PyObject* _slots_codec_pickle_module(void) {
+    // borrowed, imported on the first value that needs it
+    SlotsFactoryState *state = _slots_state();
+    if (state != NULL && state->pickle == NULL) {
+        state->pickle = PyImport_ImportModule("pickle");
+    }
+    return state == NULL ? NULL : state->pickle;
+}
+
+
+static char* _slots_codec_reserve(SlotsCodecWriter *writer, Py_ssize_t size) {
+    // pointer to size more bytes at the end of the writer
+    if (writer->size + size > writer->capacity) {
+        Py_ssize_t capacity = writer->capacity * 2 + size + 64;
+        char *data = PyMem_Realloc(writer->data, capacity);
+        if (data == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+    char *at = writer->data + writer->size;
+    writer->size += size;
+    return at;
+}
+
+
+static int _slots_codec_write(SlotsCodecWriter *writer, const void *data, Py_ssize_t size) {
+    char *at = _slots_codec_reserve(writer, size);
+    if (at == NULL) {
+        return -1;
+    }
+    memcpy(at, data, size);
+    return 0;
+}
+
+
+static int _slots_codec_write_u64(SlotsCodecWriter *writer, unsigned long long value) {
+    char *at = _slots_codec_reserve(writer, 8);
+    if (at == NULL) {
+        return -1;
+    }
+    for (int i=0; i<8; i++) {
+        at[i] = (char)(value >> (8 * i));
+    }
+    return 0;
+}
+
+
+static int _slots_codec_write_varint(SlotsCodecWriter *writer, unsigned long long value) {
+    char *at = _slots_codec_reserve(writer, 10);
+    if (at == NULL) {
+        return -1;
+    }
+    Py_ssize_t n = 0;
+    do {
+        at[n++] = (char)((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+    writer->size -= 10 - n;
+    return 0;
+}
+
+
+static int _slots_codec_write_tagged(SlotsCodecWriter *writer, char tag, const char *data, Py_ssize_t size) {
+    if (_slots_codec_write(writer, &tag, 1) == -1 || _slots_codec_write_varint(writer, size) == -1) {
+        return -1;
+    }
+    return _slots_codec_write(writer, data, size);
+}
+
+
+static int _slots_codec_write_value(SlotsCodecWriter *writer, PyObject *value) {
+    char tag;
+    if (value == NULL) {
+        tag = SLOTS_CODEC_UNSET;
+    } else if (value == Py_None) {
+        tag = SLOTS_CODEC_NONE;
+    } else if (value == Py_False || value == Py_True) {
+        tag = value == Py_True ? SLOTS_CODEC_TRUE : SLOTS_CODEC_FALSE;
+    } else if (PyLong_CheckExact(value)) {
+        int overflow;
+        long long number = PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (number == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (!overflow) {
+            // zigzag, so small negative numbers stay short too
+            tag = SLOTS_CODEC_INT;
+            unsigned long long zigzag = ((unsigned long long)number << 1) ^ (unsigned long long)(number >> 63);
+            if (_slots_codec_write(writer, &tag, 1) == -1) {
+                return -1;
+            }
+            return _slots_codec_write_varint(writer, zigzag);
+        }
+        tag = SLOTS_CODEC_PICKLE;
+    } else if (PyFloat_CheckExact(value)) {
+        tag = SLOTS_CODEC_FLOAT;
+        double number = PyFloat_AS_DOUBLE(value);
+        unsigned long long bits;
+        memcpy(&bits, &number, 8);
+        if (_slots_codec_write(writer, &tag, 1) == -1) {
+            return -1;
+        }
+        return _slots_codec_write_u64(writer, bits);
+    } else if (PyUnicode_CheckExact(value)) {
+        Py_ssize_t size;
+        const char *data = PyUnicode_AsUTF8AndSize(value, &size);
+        if (data == NULL) {
+            return -1;
+        }
+        return _slots_codec_write_tagged(writer, SLOTS_CODEC_STR, data, size);
+    } else if (PyBytes_CheckExact(value)) {
+        return _slots_codec_write_tagged(writer, SLOTS_CODEC_BYTES, PyBytes_AS_STRING(value), PyBytes_GET_SIZE(value));
+    } else {
+        tag = SLOTS_CODEC_PICKLE;
+    }
+
+    if (tag != SLOTS_CODEC_PICKLE) {
+        return _slots_codec_write(writer, &tag, 1);
+    }
+    PyObject *pickle = _slots_codec_pickle_module();
+    PyObject *pickled = pickle == NULL ? NULL : PyObject_CallMethod(pickle, "dumps", "Oi", value, -1);
+    if (pickled == NULL) {
+        return -1;
+    }
+    int result = _slots_codec_write_tagged(writer, SLOTS_CODEC_PICKLE, PyBytes_AS_STRING(pickled), PyBytes_GET_SIZE(pickled));
+    Py_DECREF(pickled);
+    return result;
+}
+
+
+static int _slots_codec_write_record(SlotsCodecWriter *writer, SlotsLayoutObject *layout, PyObject *instance) {
+    if (!PyObject_TypeCheck(instance, layout->type)) {
+        PyErr_Format(
+            PyExc_TypeError, "expected %.200s, not %.200s",
+            layout->type->tp_name, Py_TYPE(instance)->tp_name
+        );
+        return -1;
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        char *field = (char *)instance + layout->offsets[i];
+        int result;
+        switch (layout->members[i]->type) {
+            case T_LONGLONG:
+                result = _slots_codec_write_u64(writer, *(unsigned long long *)field);
+                break;
+            case T_DOUBLE:
+                result = _slots_codec_write_u64(writer, *(unsigned long long *)field);
+                break;
+            case T_BOOL:
+                result = _slots_codec_write(writer, field, 1);
+                break;
+            default:
+                result = _slots_codec_write_value(writer, *(PyObject **)field);
+        }
+        if (result == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static const unsigned char* _slots_codec_read(SlotsCodecReader *reader, Py_ssize_t size) {
+    if (size < 0 || reader->size - reader->pos < size) {
+        PyErr_SetString(PyExc_ValueError, "encoded data is truncated");
+        return NULL;
+    }
+    const unsigned char *at = reader->data + reader->pos;
+    reader->pos += size;
+    return at;
+}
+
+
+static int _slots_codec_read_u64(SlotsCodecReader *reader, unsigned long long *value) {
+    const unsigned char *at = _slots_codec_read(reader, 8);
+    if (at == NULL) {
+        return -1;
+    }
+    *value = 0;
+    for (int i=0; i<8; i++) {
+        *value |= (unsigned long long)at[i] << (8 * i);
+    }
+    return 0;
+}
+
+
+static int _slots_codec_read_varint(SlotsCodecReader *reader, unsigned long long *value) {
+    *value = 0;
+    for (int shift=0; shift<64; shift+=7) {
+        const unsigned char *at = _slots_codec_read(reader, 1);
+        if (at == NULL) {
+            return -1;
+        }
+        *value |= (unsigned long long)(*at & 0x7f) << shift;
+        if (!(*at & 0x80)) {
+            return 0;
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "encoded data has an invalid length");
+    return -1;
+}
+
+
+static int _slots_codec_read_value(SlotsCodecReader *reader, PyObject **value) {
+    // new reference in value, left NULL for unset slots
+    const unsigned char *tag = _slots_codec_read(reader, 1);
+    if (tag == NULL) {
+        return -1;
+    }
+    unsigned long long number;
+    const unsigned char *data;
+
+    switch (*tag) {
+        case SLOTS_CODEC_UNSET:
+            *value = NULL;
+            return 0;
+        case SLOTS_CODEC_NONE:
+            Py_INCREF(Py_None);
+            *value = Py_None;
+            return 0;
+        case SLOTS_CODEC_FALSE:
+        case SLOTS_CODEC_TRUE:
+            *value = PyBool_FromLong(*tag == SLOTS_CODEC_TRUE);
+            return 0;
+        case SLOTS_CODEC_INT:
+            if (_slots_codec_read_varint(reader, &number) == -1) {
+                return -1;
+            }
+            *value = PyLong_FromLongLong((long long)(number >> 1) ^ -(long long)(number & 1));
+            return *value == NULL ? -1 : 0;
+        case SLOTS_CODEC_FLOAT: {
+            double real;
+            if (_slots_codec_read_u64(reader, &number) == -1) {
+                return -1;
+            }
+            memcpy(&real, &number, 8);
+            *value = PyFloat_FromDouble(real);
+            return *value == NULL ? -1 : 0;
+        }
+        case SLOTS_CODEC_STR:
+        case SLOTS_CODEC_BYTES:
+        case SLOTS_CODEC_PICKLE:
+            if (
+                _slots_codec_read_varint(reader, &number) == -1
+                || (data = _slots_codec_read(reader, (Py_ssize_t)number)) == NULL
+            ) {
+                return -1;
+            }
+            break;
+        default:
+            PyErr_Format(PyExc_ValueError, "encoded data has an unknown tag %d", *tag);
+            return -1;
+    }
+
+    if (*tag == SLOTS_CODEC_STR) {
+        *value = PyUnicode_DecodeUTF8((const char *)data, (Py_ssize_t)number, NULL);
+    } else if (*tag == SLOTS_CODEC_BYTES) {
+        *value = PyBytes_FromStringAndSize((const char *)data, (Py_ssize_t)number);
+    } else {
+        PyObject *pickle = _slots_codec_pickle_module();
+        PyObject *view = pickle == NULL ? NULL : PyMemoryView_FromMemory((char *)data, (Py_ssize_t)number, PyBUF_READ);
+        *value = view == NULL ? NULL : PyObject_CallMethod(pickle, "loads", "O", view);
+        Py_XDECREF(view);
+    }
+    return *value == NULL ? -1 : 0;
+}
+
+
+static PyObject* _slots_codec_read_record(SlotsCodecReader *reader, SlotsLayoutObject *layout) {
+    PyObject *instance = _slots_factory_alloc(layout->type);
+    if (instance == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        char *field = (char *)instance + layout->offsets[i];
+        const unsigned char *at;
+        unsigned long long bits = 0;
+        int result = 0;
+        switch (layout->members[i]->type) {
+            case T_LONGLONG:
+            case T_DOUBLE:
+                result = _slots_codec_read_u64(reader, &bits);
+                memcpy(field, &bits, 8);
+                break;
+            case T_BOOL:
+                at = _slots_codec_read(reader, 1);
+                result = at == NULL ? -1 : 0;
+                *field = at != NULL && *at;
+                break;
+            default: {
+                PyObject *value;
+                result = _slots_codec_read_value(reader, &value);
+                if (result == 0) {
+                    Py_XSETREF(*(PyObject **)field, value);
+                }
+            }
+        }
+        if (result == -1) {
+            Py_DECREF(instance);
+            return NULL;
+        }
+    }
+    return instance;
+}
+
+
+static SlotsLayoutObject* _slots_codec_layout(PyObject *type) {
+    SlotsLayoutObject *layout = PyType_Check(type) ? _slots_layout_of((PyTypeObject *)type) : NULL;
+    if (layout == NULL || !layout->direct) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(PyExc_TypeError, "expected a type with a direct __slots_layout__");
+        }
+        return NULL;
+    }
+    return layout;
+}
+
+
+static int _slots_codec_open(SlotsCodecReader *reader, Py_buffer *buffer, SlotsLayoutObject *layout) {
+    // reads and checks the schema header, leaving reader at the first record
+    reader->data = buffer->buf;
+    reader->size = buffer->len;
+    reader->pos = 0;
+    unsigned long long schema;
+    if (_slots_codec_read_u64(reader, &schema) == -1) {
+        return -1;
+    }
+    if (schema != layout->schema) {
+        PyErr_Format(
+            PyExc_ValueError, "encoded data has schema %016llx, %.200s is %016llx",
+            schema, layout->type->tp_name, layout->schema
+        );
+        return -1;
+    }
+    return 0;
+}
+
+
+static int _slots_codec_close(SlotsCodecReader *reader) {
+    if (reader->pos != reader->size) {
+        PyErr_Format(PyExc_ValueError, "%zd bytes of extra data after the encoded records", reader->size - reader->pos);
+        return -1;
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_codec_bytes(SlotsCodecWriter *writer, int ok) {
+    PyObject *result = ok ? PyBytes_FromStringAndSize(writer->data, writer->size) : NULL;
+    PyMem_Free(writer->data);
+    return result;
+}
+
+
+static PyObject* _slots_factory_encode(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_encode", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_codec_layout(args[0]);
+    if (layout == NULL) {
+        return NULL;
+    }
+    SlotsCodecWriter writer = {NULL, 0, 0};
+    int ok = (
+        _slots_codec_write_u64(&writer, layout->schema) == 0
+        && _slots_codec_write_record(&writer, layout, args[1]) == 0
+    );
+    return _slots_codec_bytes(&writer, ok);
+}
+
+
+static PyObject* _slots_factory_encode_many(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_encode_many", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_codec_layout(args[0]);
+    if (layout == NULL) {
+        return NULL;
+    }
+    PyObject *items = PySequence_Fast(args[1], "encode_many() argument must be iterable");
+    if (items == NULL) {
+        return NULL;
+    }
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(items);
+    SlotsCodecWriter writer = {NULL, 0, 0};
+    int ok = (
+        _slots_codec_write_u64(&writer, layout->schema) == 0
+        && _slots_codec_write_varint(&writer, size) == 0
+    );
+    for (Py_ssize_t i=0; ok && i<size; i++) {
+        ok = _slots_codec_write_record(&writer, layout, PySequence_Fast_GET_ITEM(items, i)) == 0;
+    }
+    Py_DECREF(items);
+    return _slots_codec_bytes(&writer, ok);
+}
+
+
+static PyObject* _slots_factory_decode(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_decode", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_codec_layout(args[0]);
+    Py_buffer buffer;
+    if (layout == NULL || PyObject_GetBuffer(args[1], &buffer, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    SlotsCodecReader reader;
+    PyObject *instance = NULL;
+    if (_slots_codec_open(&reader, &buffer, layout) == 0) {
+        instance = _slots_codec_read_record(&reader, layout);
+    }
+    if (instance != NULL && _slots_codec_close(&reader) == -1) {
+        Py_CLEAR(instance);
+    }
+    PyBuffer_Release(&buffer);
+    return instance;
+}
+
+
+static PyObject* _slots_factory_decode_many(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    if (_slots_factory_nargs("_slots_factory_decode_many", nargs, 2) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_codec_layout(args[0]);
+    Py_buffer buffer;
+    if (layout == NULL || PyObject_GetBuffer(args[1], &buffer, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    SlotsCodecReader reader;
+    unsigned long long size;
+    PyObject *result = NULL;
+    if (
+        _slots_codec_open(&reader, &buffer, layout) == 0
+        && _slots_codec_read_varint(&reader, &size) == 0
+    ) {
+        // every record takes at least a byte, unless the type has no slots
+        if (layout->size > 0 && size > (unsigned long long)(reader.size - reader.pos)) {
+            PyErr_SetString(PyExc_ValueError, "encoded data is truncated");
+        } else {
+            result = PyList_New((Py_ssize_t)size);
+        }
+    }
+    for (Py_ssize_t i=0; result != NULL && i<(Py_ssize_t)size; i++) {
+        PyObject *instance = _slots_codec_read_record(&reader, layout);
+        if (instance == NULL) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, i, instance);
+    }
+    if (result != NULL && _slots_codec_close(&reader) == -1) {
+        Py_CLEAR(result);
+    }
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+
+static SlotsLayoutObject* _slots_rebuild_layout(PyObject *key) {
+    // borrowed layout of the type a reduce key names: the type itself, or
+    // the registered type of its schema, built as a fast_slots type when
+    // this process has none
+    PyObject *type = NULL;
+    if (PyType_Check(key)) {
+        Py_INCREF(key);
+        type = key;
+    } else if (PyTuple_Check(key) && (PyTuple_GET_SIZE(key) == 3 || PyTuple_GET_SIZE(key) == 4)) {
+        type = _slots_registry_find(key);
+        if (type == NULL && !PyErr_Occurred()) {
+            PyObject *module = PyImport_ImportModule("slots_factory.slots_factory");
+            type = module == NULL ? NULL : PyObject_CallMethod(
+                module, "_slots_type", "OO", PyTuple_GET_ITEM(key, 1), PyTuple_GET_ITEM(key, 2)
+            );
+            Py_XDECREF(module);
+        }
+    } else {
+        PyErr_Format(PyExc_TypeError, "invalid reduce key %R", key);
+    }
+    if (type == NULL) {
+        return NULL;
+    }
+
+    SlotsLayoutObject *layout = _slots_codec_layout(type);
+    Py_DECREF(type);
+    if (layout != NULL && !PyType_Check(key)) {
+        unsigned long long schema = PyLong_AsUnsignedLongLong(PyTuple_GET_ITEM(key, 0));
+        if (schema != layout->schema) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_ValueError, "no type with the schema of %R", key);
+            }
+            return NULL;
+        }
+    }
+    return layout;
+}
+
+
+static int _slots_rebuild_unset(PyObject *instance, SlotsLayoutObject *layout, PyObject *values, PyObject *unset, int objects) {
+    // stores values into the slots of instance (only the object slots when
+    // objects is set), leaving the value indexes listed in unset empty
+    Py_ssize_t n = 0;
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        int kind = layout->members[i]->type;
+        if (objects && kind != T_OBJECT_EX) {
+            continue;
+        }
+        if (n >= PyTuple_GET_SIZE(values)) {
+            PyErr_Format(PyExc_ValueError, "%.200s takes %zd values", layout->type->tp_name, layout->size);
+            return -1;
+        }
+        PyObject *value = PyTuple_GET_ITEM(values, n++);
+        char *field = (char *)instance + layout->offsets[i];
+        if (kind != T_OBJECT_EX) {
+            if (_slots_native_store(kind, field, value) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        Py_INCREF(value);
+        Py_XSETREF(*(PyObject **)field, value);
+    }
+    if (n != PyTuple_GET_SIZE(values)) {
+        PyErr_Format(PyExc_ValueError, "%.200s takes %zd values", layout->type->tp_name, n);
+        return -1;
+    }
+
+    for (Py_ssize_t k=0; unset != NULL && k<PyTuple_GET_SIZE(unset); k++) {
+        Py_ssize_t index = PyNumber_AsSsize_t(PyTuple_GET_ITEM(unset, k), PyExc_IndexError);
+        if (index == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        // value indexes map back onto slots by skipping the native ones
+        for (Py_ssize_t i=0, j=0; i<layout->size; i++) {
+            if (objects && layout->members[i]->type != T_OBJECT_EX) {
+                continue;
+            }
+            if (j++ == index && layout->members[i]->type == T_OBJECT_EX) {
+                Py_CLEAR(*(PyObject **)((char *)instance + layout->offsets[i]));
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_factory_rebuild(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // rebuild(key, values, unset=()), the reconstructor __reduce__ returns
+    if (nargs != 2 && _slots_factory_nargs("_slots_factory_rebuild", nargs, 3) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_rebuild_layout(args[0]);
+    if (layout == NULL) {
+        return NULL;
+    }
+    if (!PyTuple_Check(args[1]) || (nargs == 3 && !PyTuple_Check(args[2]))) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_rebuild() takes tuples of values");
+    }
+    PyObject *instance = _slots_factory_alloc(layout->type);
+    if (instance != NULL && _slots_rebuild_unset(instance, layout, args[1], nargs == 3 ? args[2] : NULL, 0) == -1) {
+        Py_CLEAR(instance);
+    }
+    return instance;
+}
+
+
+static PyObject* _slots_factory_rebuild_packed(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+    // rebuild_packed(key, buffer, values, unset=()), for packed types pickled
+    // with protocol 5: buffer holds the struct_format record of the native
+    // fields and values the object slots
+    if (nargs != 3 && _slots_factory_nargs("_slots_factory_rebuild_packed", nargs, 4) == -1) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = _slots_rebuild_layout(args[0]);
+    if (layout == NULL) {
+        return NULL;
+    }
+    if (!PyTuple_Check(args[2]) || (nargs == 4 && !PyTuple_Check(args[3]))) {
+        return PyErr_Format(PyExc_TypeError, "_slots_factory_rebuild_packed() takes tuples of values");
+    }
+    Py_ssize_t size = _slots_storage_size(layout->type);
+    Py_buffer buffer;
+    if (size == -1 || PyObject_GetBuffer(args[1], &buffer, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    PyObject *instance = NULL;
+    if (buffer.len != size) {
+        PyErr_Format(PyExc_ValueError, "%.200s takes a buffer of %zd bytes", layout->type->tp_name, size);
+    } else if ((instance = _slots_factory_alloc(layout->type)) != NULL) {
+        memcpy((char *)instance + sizeof(PyObject), buffer.buf, size);
+        for (Py_ssize_t i=0; i<layout->size; i++) {
+            if (layout->members[i]->type == T_BOOL) {
+                char *field = (char *)instance + layout->offsets[i];
+                *field = *field != 0;
+            }
+        }
+        if (_slots_rebuild_unset(instance, layout, args[2], nargs == 4 ? args[3] : NULL, 1) == -1) {
+            Py_CLEAR(instance);
+        }
+    }
+    PyBuffer_Release(&buffer);
+    return instance;
+}
+
+
+typedef struct {
+    Py_hash_t hash;
+    PyObject *name;
+    PyObject *keys;
+    PyObject *type;
+} SlotsCacheEntry;
+
+
+typedef struct {
+    // serializes the builds of types missing from a cache, reentrant for
+    // the thread holding it
+    PyThread_type_lock lock;
+    unsigned long owner;
+} SlotsBuildLock;
+
+
+typedef PyObject* (*SlotsCacheFind)(PyObject *cache, PyObject *name, PyObject *kwargs);
+typedef PyObject* (*SlotsCacheStore)(PyObject *cache, PyObject *name, PyObject *kwargs, PyObject *type);
+
+
+static int _slots_build_acquire(SlotsBuildLock *build) {
+    // 1 once acquired, 0 when this thread already holds it
+    unsigned long thread = PyThread_get_thread_ident();
+    if (build->owner == thread) {
+        return 0;
+    }
+    if (!PyThread_acquire_lock(build->lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(build->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+    build->owner = thread;
+    return 1;
+}
+
+
+static void _slots_build_release(SlotsBuildLock *build) {
+    build->owner = 0;
+    PyThread_release_lock(build->lock);
+}
+
+
+static int _slots_stats_name(PyObject **counts, PyObject *name, Py_ssize_t i) {
+    // counts name's misses (i 0) or builds (i 1) in the [misses, builds]
+    // lists a cache keeps by name while stats are on
+    if (_slots_stats_state() == NULL) {
+        return 0;
+    }
+    if (*counts == NULL && (*counts = PyDict_New()) == NULL) {
+        return -1;
+    }
+    PyObject *count = PyDict_GetItemWithError(*counts, name);
+    if (count == NULL) {
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+        count = Py_BuildValue("[ii]", 0, 0);
+        int result = count == NULL ? -1 : PyDict_SetItem(*counts, name, count);
+        Py_XDECREF(count);
+        if (result == -1) {
+            return -1;
+        }
+    }
+    PyObject *value = PyLong_FromSsize_t(PyLong_AsSsize_t(PyList_GET_ITEM(count, i)) + 1);
+    return value == NULL ? -1 : PyList_SetItem(count, i, value);
+}
+
+
+static int _slots_stats_lookup(PyObject **counts, PyObject *name, PyObject *type) {
+    // a cache hit on type, or a miss on name when type is None
+    if (type == Py_None) {
+        return _slots_stats_name(counts, name, 0);
+    }
+    SlotsStats *stats;
+    if (!PyType_Check(type) || _slots_stats((PyTypeObject *)type, &stats) == -1) {
+        return PyErr_Occurred() ? -1 : 0;
+    }
+    if (stats != NULL) {
+        stats->hits++;
+    }
+    return 0;
+}
+
+
+static PyObject* _slots_cache_build(PyObject *cache, SlotsBuildLock *build, PyObject **counts, SlotsCacheFind find, SlotsCacheStore store, PyObject *const *args, Py_ssize_t nargs) {
+    // get_or_build(name, kwargs, build): reads never wait, a miss takes the
+    // build lock and looks again, so threads missing on the same shape at
+    // once share the type built by the first instead of each building one
+    if (
+        _slots_factory_nargs("get_or_build", nargs, 3) == -1
+        || _slots_factory_dict_arg("get_or_build", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    PyObject *type = find(cache, args[0], args[1]);
+    if (type != Py_None) {
+        return type;
+    }
+    Py_DECREF(type);
+
+    int held = _slots_build_acquire(build);
+    type = find(cache, args[0], args[1]);
+    if (type == Py_None) {
+        Py_DECREF(type);
+        PyObject *built = PyObject_CallObject(args[2], NULL);
+        type = built == NULL ? NULL : store(cache, args[0], args[1], built);
+        Py_XDECREF(built);
+        if (type != NULL && _slots_stats_name(counts, args[0], 1) == -1) {
+            Py_CLEAR(type);
+        }
+    }
+    if (held) {
+        _slots_build_release(build);
+    }
+    return type;
+}
+
+
+static int _slots_build_init(SlotsBuildLock *build) {
+    build->owner = 0;
+    build->lock = PyThread_allocate_lock();
+    if (build->lock == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+
+static void _slots_build_free(SlotsBuildLock *build) {
+    if (build->lock != NULL) {
+        PyThread_free_lock(build->lock);
+        build->lock = NULL;
+    }
+}
+
+
+typedef struct {
+    PyObject_HEAD
+    SlotsCacheEntry *table;
+    Py_ssize_t mask;
+    Py_ssize_t used;
+    SlotsBuildLock build;
+    // [misses, builds] by name while stats are on, NULL until then
+    PyObject *counts;
+} SlotsTypeCacheObject;
+
+
+#define SLOTS_CACHE_MINSIZE 8
+
+
+static inline Py_uhash_t _slots_cache_shuffle(Py_uhash_t h) {
+    // spreads key hashes before summing, the same mix frozenset uses
+    return ((h ^ 89869747UL) ^ (h << 16)) * 3644798167UL;
+}
+
+
+static Py_hash_t _slots_cache_hash(PyObject *name, PyObject *kwargs) {
+    // order independent hash of (name, keys), str hashes are cached on the
+    // strings themselves so this never allocates
+    Py_uhash_t h = (Py_uhash_t)PyObject_Hash(name);
+    Py_uhash_t keys = (Py_uhash_t)PyDict_GET_SIZE(kwargs) * 1927868237UL;
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    if (h == (Py_uhash_t)-1) {
+        return -1;
+    }
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        Py_hash_t key_hash = PyObject_Hash(key);
+        if (key_hash == -1) {
+            return -1;
+        }
+        keys += _slots_cache_shuffle((Py_uhash_t)key_hash);
+    }
+    h = (h * 1000003UL) ^ keys;
+    return h == (Py_uhash_t)-1 ? -2 : (Py_hash_t)h;
+}
+
+
+static int _slots_cache_matches(SlotsCacheEntry *entry, Py_hash_t hash, PyObject *name, PyObject *kwargs) {
+    if (entry->hash != hash || PySet_GET_SIZE(entry->keys) != PyDict_GET_SIZE(kwargs)) {
+        return 0;
+    }
+    int result = PyObject_RichCompareBool(entry->name, name, Py_EQ);
+    if (result != 1) {
+        return result;
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        result = PySet_Contains(entry->keys, key);
+        if (result != 1) {
+            return result;
+        }
+    }
+    return 1;
+}
+
+
+static SlotsCacheEntry* _slots_cache_lookup(SlotsTypeCacheObject *cache, Py_hash_t hash, PyObject *name, PyObject *kwargs) {
+    // the matching entry, or the empty entry it would go in. NULL on error
+    Py_uhash_t i = (Py_uhash_t)hash & cache->mask;
+
+    while (1) {
+        SlotsCacheEntry *entry = &cache->table[i];
+        if (entry->type == NULL) {
+            return entry;
+        }
+        int result = _slots_cache_matches(entry, hash, name, kwargs);
+        if (result == 1) {
+            return entry;
+        }
+        if (result == -1) {
+            return NULL;
+        }
+        i = (i + 1) & cache->mask;
+    }
+}
+
+
+static int _slots_cache_resize(SlotsTypeCacheObject *cache, Py_ssize_t size) {
+    SlotsCacheEntry *table = PyMem_Calloc(size, sizeof(SlotsCacheEntry));
+    if (table == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (Py_ssize_t i=0; i<=cache->mask; i++) {
+        SlotsCacheEntry *entry = &cache->table[i];
+        if (entry->type == NULL) {
+            continue;
+        }
+        Py_uhash_t j = (Py_uhash_t)entry->hash & (size - 1);
+        while (table[j].type != NULL) {
+            j = (j + 1) & (size - 1);
+        }
+        table[j] = *entry;
+    }
+
+    PyMem_Free(cache->table);
+    cache->table = table;
+    cache->mask = size - 1;
+    return 0;
+}
+
+
+static PyObject* _slots_cache_find_locked(SlotsTypeCacheObject *cache, PyObject *name, PyObject *kwargs) {
+    // new reference to the cached type, None when there isn't one
+    Py_hash_t hash = _slots_cache_hash(name, kwargs);
+    if (hash == -1) {
+        return NULL;
+    }
+    SlotsCacheEntry *entry = _slots_cache_lookup(cache, hash, name, kwargs);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (entry->type == NULL) {
+        Py_RETURN_NONE;
+    }
+    Py_INCREF(entry->type);
+    return entry->type;
+}
+
+
+static PyObject* _slots_cache_store_locked(SlotsTypeCacheObject *cache, PyObject *name, PyObject *kwargs, PyObject *type) {
+    Py_hash_t hash = _slots_cache_hash(name, kwargs);
+    if (hash == -1) {
+        return NULL;
+    }
+    SlotsCacheEntry *entry = _slots_cache_lookup(cache, hash, name, kwargs);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    if (entry->type != NULL) {
+        Py_INCREF(type);
+        Py_SETREF(entry->type, type);
+        Py_INCREF(type);
+        return type;
+    }
+
+    PyObject *keys = PyFrozenSet_New(NULL);
+    if (keys == NULL) {
+        return NULL;
+    }
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        Py_INCREF(key);
+        if (PyUnicode_CheckExact(key)) {
+            PyUnicode_InternInPlace(&key);
+        }
+        int result = PySet_Add(keys, key);
+        Py_DECREF(key);
+        if (result == -1) {
+            Py_DECREF(keys);
+            return NULL;
+        }
+    }
+
+    Py_INCREF(name);
+    Py_INCREF(type);
+    entry->hash = hash;
+    entry->name = name;
+    entry->keys = keys;
+    entry->type = type;
+    cache->used++;
+
+    if (cache->used * 3 >= (cache->mask + 1) * 2 && _slots_cache_resize(cache, (cache->mask + 1) * 2) == -1) {
+        return NULL;
+    }
+
+    Py_INCREF(type);
+    return type;
+}
+
+
+static PyObject* _slots_cache_find(PyObject *cache, PyObject *name, PyObject *kwargs) {
+    PyObject *type;
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    type = _slots_cache_find_locked((SlotsTypeCacheObject *)cache, name, kwargs);
+    SLOTS_END_CRITICAL_SECTION();
+    return type;
+}
+
+
+static PyObject* _slots_cache_store(PyObject *cache, PyObject *name, PyObject *kwargs, PyObject *type) {
+    PyObject *result;
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    result = _slots_cache_store_locked((SlotsTypeCacheObject *)cache, name, kwargs, type);
+    SLOTS_END_CRITICAL_SECTION();
+    return result;
+}
+
+
+static PyObject* _slots_cache_get(SlotsTypeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    if (
+        _slots_factory_nargs("get", nargs, 2) == -1
+        || _slots_factory_dict_arg("get", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    PyObject *type = _slots_cache_find((PyObject *)cache, args[0], args[1]);
+    if (type != NULL && _slots_stats_lookup(&cache->counts, args[0], type) == -1) {
+        Py_CLEAR(type);
+    }
+    return type;
+}
+
+
+static PyObject* _slots_cache_set(SlotsTypeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    if (
+        _slots_factory_nargs("set", nargs, 3) == -1
+        || _slots_factory_dict_arg("set", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    return _slots_cache_store((PyObject *)cache, args[0], args[1], args[2]);
+}
+
+
+static PyObject* _slots_cache_get_or_build(SlotsTypeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    return _slots_cache_build((PyObject *)cache, &cache->build, &cache->counts, _slots_cache_find, _slots_cache_store, args, nargs);
+}
+
+
+static int _slots_cache_clear(SlotsTypeCacheObject *cache) {
+    for (Py_ssize_t i=0; i<=cache->mask; i++) {
+        SlotsCacheEntry *entry = &cache->table[i];
+        Py_CLEAR(entry->name);
+        Py_CLEAR(entry->keys);
+        Py_CLEAR(entry->type);
+    }
+    cache->used = 0;
+    return 0;
+}
+
+
+static PyObject* _slots_cache_clear_method(SlotsTypeCacheObject *cache, PyObject *Py_UNUSED(ignored)) {
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    _slots_cache_clear(cache);
+    SLOTS_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+
+static Py_ssize_t _slots_cache_len(SlotsTypeCacheObject *cache) {
+    return cache->used;
+}
+
+
+static int _slots_cache_traverse(SlotsTypeCacheObject *cache, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(cache);
+    for (Py_ssize_t i=0; i<=cache->mask; i++) {
+        Py_VISIT(cache->table[i].type);
+    }
+    Py_VISIT(cache->counts);
+    return 0;
+}
+
+
+static void _slots_cache_dealloc(SlotsTypeCacheObject *cache) {
+    PyObject_GC_UnTrack(cache);
+    if (cache->table != NULL) {
+        _slots_cache_clear(cache);
+        PyMem_Free(cache->table);
+    }
+    Py_CLEAR(cache->counts);
+    _slots_build_free(&cache->build);
+    PyTypeObject *type = Py_TYPE(cache);
+    type->tp_free((PyObject *)cache);
+    Py_DECREF(type);
+}
+
+
+static PyObject* _slots_cache_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    if (PyTuple_GET_SIZE(args) || (kwargs != NULL && PyDict_GET_SIZE(kwargs))) {
+        return PyErr_Format(PyExc_TypeError, "%s() takes no arguments", type->tp_name);
+    }
+    SlotsTypeCacheObject *cache = (SlotsTypeCacheObject *)type->tp_alloc(type, 0);
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->build.lock = NULL;
+    cache->counts = NULL;
+    cache->table = PyMem_Calloc(SLOTS_CACHE_MINSIZE, sizeof(SlotsCacheEntry));
+    if (cache->table == NULL) {
+        Py_DECREF(cache);
+        return PyErr_NoMemory();
+    }
+    if (_slots_build_init(&cache->build) == -1) {
+        Py_DECREF(cache);
+        return NULL;
+    }
+    cache->mask = SLOTS_CACHE_MINSIZE - 1;
+    cache->used = 0;
+    return (PyObject *)cache;
+}
+
+
+static PyMethodDef _slots_cache_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))_slots_cache_get, METH_FASTCALL, "get(name, kwargs): the cached type for name and the keys of kwargs, or None"},
+    {"set", (PyCFunction)(void(*)(void))_slots_cache_set, METH_FASTCALL, "set(name, kwargs, type): caches type for name and the keys of kwargs, returns type"},
+    {"get_or_build", (PyCFunction)(void(*)(void))_slots_cache_get_or_build, METH_FASTCALL, "get_or_build(name, kwargs, build): the cached type, or the one build() returns once cached, built by one thread at a time"},
+    {"clear", (PyCFunction)_slots_cache_clear_method, METH_NOARGS, "removes every cached type"},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_cache_slots[] = {
+    {Py_tp_doc, "types keyed by (name, frozenset of attribute names), probed without allocating"},
+    {Py_tp_new, _slots_cache_new},
+    {Py_tp_traverse, _slots_cache_traverse},
+    {Py_tp_clear, _slots_cache_clear},
+    {Py_tp_dealloc, _slots_cache_dealloc},
+    {Py_tp_methods, _slots_cache_methods},
+    {Py_sq_length, _slots_cache_len},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsTypeCacheSpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.TypeCache",
+    .basicsize = sizeof(SlotsTypeCacheObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | SLOTS_TPFLAGS_IMMUTABLE,
+    .slots = _slots_cache_slots,
+};
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *names;
+    SlotsBuildLock build;
+    // [misses, builds] by name while stats are on, NULL until then
+    PyObject *counts;
+} SlotsShapeCacheObject;
+
+
+#define SLOTS_SHAPES_PER_NAME 4
+
+
+static int _slots_shapes_matches(PyObject *keys, PyObject *kwargs) {
+    // keys are interned and kwargs arriving from a call site share them, so
+    // an identity scan in order settles the common case without hashing
+    Py_ssize_t size = PyTuple_GET_SIZE(keys);
+    if (size != PyDict_GET_SIZE(kwargs)) {
+        return 0;
+    }
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, i = 0;
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        if (PyTuple_GET_ITEM(keys, i) != key) {
+            break;
+        }
+        i++;
+    }
+    if (i == size) {
+        return 1;
+    }
+
+    for (i=0; i<size; i++) {
+        int result = PyDict_Contains(kwargs, PyTuple_GET_ITEM(keys, i));
+        if (result != 1) {
+            return result;
+        }
+    }
+    return 1;
+}
+
+
+static PyObject* _slots_shapes_find_locked(SlotsShapeCacheObject *cache, PyObject *name, PyObject *kwargs) {
+    // new reference to the cached type, None when there isn't one
+    PyObject *shapes = PyDict_GetItemWithError(cache->names, name);
+    if (shapes == NULL) {
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
+    for (Py_ssize_t i=0; i<PyList_GET_SIZE(shapes); i++) {
+        PyObject *shape = PyList_GET_ITEM(shapes, i);
+        int result = _slots_shapes_matches(PyTuple_GET_ITEM(shape, 0), kwargs);
+        if (result == -1) {
+            return NULL;
+        }
+        if (result == 1) {
+            PyObject *type = PyTuple_GET_ITEM(shape, 1);
+            Py_INCREF(type);
+            return type;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_shapes_store_locked(SlotsShapeCacheObject *cache, PyObject *name, PyObject *kwargs, PyObject *type) {
+    PyObject *shapes = PyDict_GetItemWithError(cache->names, name);
+    if (shapes == NULL) {
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        shapes = PyList_New(0);
+        if (shapes == NULL) {
+            return NULL;
+        }
+        int result = PyDict_SetItem(cache->names, name, shapes);
+        Py_DECREF(shapes);
+        if (result == -1) {
+            return NULL;
+        }
+    }
+
+    PyObject *keys = PyTuple_New(PyDict_GET_SIZE(kwargs));
+    if (keys == NULL) {
+        return NULL;
+    }
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, i = 0;
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        Py_INCREF(key);
+        if (PyUnicode_CheckExact(key)) {
+            PyUnicode_InternInPlace(&key);
+        }
+        PyTuple_SET_ITEM(keys, i++, key);
+    }
+
+    for (i=0; i<PyList_GET_SIZE(shapes); i++) {
+        int result = _slots_shapes_matches(PyTuple_GET_ITEM(PyList_GET_ITEM(shapes, i), 0), kwargs);
+        if (result == -1 || (result == 1 && PySequence_DelItem(shapes, i) == -1)) {
+            Py_DECREF(keys);
+            return NULL;
+        }
+        if (result == 1) {
+            break;
+        }
+    }
+
+    PyObject *shape = PyTuple_Pack(2, keys, type);
+    Py_DECREF(keys);
+    if (shape == NULL) {
+        return NULL;
+    }
+    // the oldest shape makes way once a name has cycled through a few
+    if (
+        (PyList_GET_SIZE(shapes) >= SLOTS_SHAPES_PER_NAME && PySequence_DelItem(shapes, 0) == -1)
+        || PyList_Append(shapes, shape) == -1
+    ) {
+        Py_DECREF(shape);
+        return NULL;
+    }
+    Py_DECREF(shape);
+
+    Py_INCREF(type);
+    return type;
+}
+
+
+static PyObject* _slots_shapes_find(PyObject *cache, PyObject *name, PyObject *kwargs) {
+    PyObject *type;
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    type = _slots_shapes_find_locked((SlotsShapeCacheObject *)cache, name, kwargs);
+    SLOTS_END_CRITICAL_SECTION();
+    return type;
+}
+
+
+static PyObject* _slots_shapes_store(PyObject *cache, PyObject *name, PyObject *kwargs, PyObject *type) {
+    PyObject *result;
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    result = _slots_shapes_store_locked((SlotsShapeCacheObject *)cache, name, kwargs, type);
+    SLOTS_END_CRITICAL_SECTION();
+    return result;
+}
+
+
+static PyObject* _slots_shapes_get(SlotsShapeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    if (
+        _slots_factory_nargs("get", nargs, 2) == -1
+        || _slots_factory_dict_arg("get", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    PyObject *type = _slots_shapes_find((PyObject *)cache, args[0], args[1]);
+    if (type != NULL && _slots_stats_lookup(&cache->counts, args[0], type) == -1) {
+        Py_CLEAR(type);
+    }
+    return type;
+}
+
+
+static PyObject* _slots_shapes_set(SlotsShapeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    if (
+        _slots_factory_nargs("set", nargs, 3) == -1
+        || _slots_factory_dict_arg("set", args, 1) == -1
+    ) {
+        return NULL;
+    }
+    return _slots_shapes_store((PyObject *)cache, args[0], args[1], args[2]);
+}
+
+
+static PyObject* _slots_shapes_get_or_build(SlotsShapeCacheObject *cache, PyObject *const *args, Py_ssize_t nargs) {
+    return _slots_cache_build((PyObject *)cache, &cache->build, &cache->counts, _slots_shapes_find, _slots_shapes_store, args, nargs);
+}
+
+
+static PyObject* _slots_shapes_clear_method(SlotsShapeCacheObject *cache, PyObject *Py_UNUSED(ignored)) {
+    SLOTS_BEGIN_CRITICAL_SECTION(cache);
+    PyDict_Clear(cache->names);
+    SLOTS_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+
+static Py_ssize_t _slots_shapes_len(SlotsShapeCacheObject *cache) {
+    return PyDict_GET_SIZE(cache->names);
+}
+
+
+static int _slots_shapes_traverse(SlotsShapeCacheObject *cache, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(cache);
+    Py_VISIT(cache->names);
+    Py_VISIT(cache->counts);
+    return 0;
+}
+
+
+static int _slots_shapes_clear(SlotsShapeCacheObject *cache) {
+    // names stays an empty dict, the cache is still usable after a collection
+    if (cache->names != NULL) {
+        PyDict_Clear(cache->names);
+    }
+    Py_CLEAR(cache->counts);
+    return 0;
+}
+
+
+static void _slots_shapes_dealloc(SlotsShapeCacheObject *cache) {
+    PyObject_GC_UnTrack(cache);
+    _slots_shapes_clear(cache);
+    Py_CLEAR(cache->names);
+    _slots_build_free(&cache->build);
+    PyTypeObject *type = Py_TYPE(cache);
+    type->tp_free((PyObject *)cache);
+    Py_DECREF(type);
+}
+
+
+static PyObject* _slots_shapes_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    if (PyTuple_GET_SIZE(args) || (kwargs != NULL && PyDict_GET_SIZE(kwargs))) {
+        return PyErr_Format(PyExc_TypeError, "%s() takes no arguments", type->tp_name);
+    }
+    SlotsShapeCacheObject *cache = (SlotsShapeCacheObject *)type->tp_alloc(type, 0);
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->build.lock = NULL;
+    cache->counts = NULL;
+    cache->names = PyDict_New();
+    if (cache->names == NULL || _slots_build_init(&cache->build) == -1) {
+        Py_DECREF(cache);
+        return NULL;
+    }
+    return (PyObject *)cache;
+}
+
+
+static PyMethodDef _slots_shapes_methods[] = {
+    {"get", (PyCFunction)(void(*)(void))_slots_shapes_get, METH_FASTCALL, "get(name, kwargs): the cached type for name whose shape matches the keys of kwargs, or None"},
+    {"set", (PyCFunction)(void(*)(void))_slots_shapes_set, METH_FASTCALL, "set(name, kwargs, type): caches type as a shape of name, evicting the oldest past a few shapes, returns type"},
+    {"get_or_build", (PyCFunction)(void(*)(void))_slots_shapes_get_or_build, METH_FASTCALL, "get_or_build(name, kwargs, build): the cached type, or the one build() returns once cached, built by one thread at a time"},
+    {"clear", (PyCFunction)_slots_shapes_clear_method, METH_NOARGS, "removes every cached type"},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_shapes_slots[] = {
+    {Py_tp_doc, "a few types per name, matched by the identity of their attribute names"},
+    {Py_tp_new, _slots_shapes_new},
+    {Py_tp_traverse, _slots_shapes_traverse},
+    {Py_tp_clear, _slots_shapes_clear},
+    {Py_tp_dealloc, _slots_shapes_dealloc},
+    {Py_tp_methods, _slots_shapes_methods},
+    {Py_sq_length, _slots_shapes_len},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsShapeCacheSpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.ShapeCache",
+    .basicsize = sizeof(SlotsShapeCacheObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | SLOTS_TPFLAGS_IMMUTABLE,
+    .slots = _slots_shapes_slots,
+};
+
+
+static PyObject* _slots_factory_stats_enable(PyObject *self, PyObject *arg) {
+    int on = PyObject_IsTrue(arg);
+    SlotsFactoryState *state = on == -1 ? NULL : _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    if (on != state->stats) {
+        state->stats = on;
+        SLOTS_STATS_ACTIVE_ADD(on ? 1 : -1);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* _slots_stats_names(PyObject *counts) {
+    // {name: {"misses": n, "builds": n, "rebuilds": n}}, a rebuild being any
+    // build of a name after its first
+    PyObject *result = PyDict_New();
+    PyObject *name, *count;
+    Py_ssize_t pos = 0;
+    while (result != NULL && counts != NULL && PyDict_Next(counts, &pos, &name, &count)) {
+        Py_ssize_t misses = PyLong_AsSsize_t(PyList_GET_ITEM(count, 0));
+        Py_ssize_t builds = PyLong_AsSsize_t(PyList_GET_ITEM(count, 1));
+        PyObject *entry = Py_BuildValue(
+            "{s:n,s:n,s:n}", "misses", misses, "builds", builds, "rebuilds", builds > 0 ? builds - 1 : 0
+        );
+        if (entry == NULL || PyDict_SetItem(result, name, entry) == -1) {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    return result;
+}
+
+
+static SlotsStats* _slots_stats_listed(SlotsFactoryState *state, PyObject *ref, PyObject **type) {
+    // counters of a listed type, with a new reference to it in *type. NULL
+    // once the type is gone, with an exception on errors
+    *type = PyObject_CallObject(ref, NULL);
+    if (*type == NULL) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = *type == Py_None ? NULL : _slots_layout_in(state, (PyTypeObject *)*type);
+    if (layout == NULL) {
+        Py_CLEAR(*type);
+        return NULL;
+    }
+    return &layout->stats;
+}
+
+
+static PyObject* _slots_stats_types(SlotsFactoryState *state) {
+    // {type: counters} for the listed types, dropping the ones gone
+    PyObject *result = PyDict_New();
+    PyObject *alive = PyList_New(0);
+    if (result == NULL || alive == NULL) {
+        goto error;
+    }
+    for (Py_ssize_t i=0; i<PyList_GET_SIZE(state->stats_types); i++) {
+        PyObject *ref = PyList_GET_ITEM(state->stats_types, i);
+        PyObject *type;
+        SlotsStats *stats = _slots_stats_listed(state, ref, &type);
+        if (stats == NULL) {
+            if (PyErr_Occurred()) {
+                goto error;
+            }
+            continue;
+        }
+        PyObject *counters = Py_BuildValue(
+            "{s:L,s:L,s:L,s:L,s:L}",
+            "created", stats->created, "hits", stats->hits, "frozen", stats->frozen,
+            "callables_ns", stats->callables_ns, "dependents_ns", stats->dependents_ns
+        );
+        int failed = (
+            counters == NULL || PyDict_SetItem(result, type, counters) == -1
+            || PyList_Append(alive, ref) == -1
+        );
+        Py_XDECREF(counters);
+        Py_DECREF(type);
+        if (failed) {
+            goto error;
+        }
+    }
+    Py_SETREF(state->stats_types, alive);
+    return result;
+
+error:
+    Py_XDECREF(result);
+    Py_XDECREF(alive);
+    return NULL;
+}
+
+
+static PyObject* _slots_factory_stats(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    PyObject *types = _slots_stats_types(state);
+    PyObject *names = types == NULL ? NULL : _slots_stats_names(((SlotsTypeCacheObject *)state->type_cache)->counts);
+    PyObject *shapes = names == NULL ? NULL : _slots_stats_names(((SlotsShapeCacheObject *)state->shape_cache)->counts);
+    if (shapes == NULL) {
+        Py_XDECREF(types);
+        Py_XDECREF(names);
+        return NULL;
+    }
+    return Py_BuildValue(
+        "{s:O,s:N,s:N,s:N}", "enabled", state->stats ? Py_True : Py_False,
+        "types", types, "slots_factory", names, "fast_slots", shapes
+    );
+}
+
+
+static PyObject* _slots_factory_stats_reset(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    SlotsFactoryState *state = _slots_state();
+    if (state == NULL) {
+        return NULL;
+    }
+    PyObject *listed = PyList_New(0);
+    if (listed == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<PyList_GET_SIZE(state->stats_types); i++) {
+        PyObject *type;
+        SlotsStats *stats = _slots_stats_listed(state, PyList_GET_ITEM(state->stats_types, i), &type);
+        if (stats == NULL && PyErr_Occurred()) {
+            Py_DECREF(listed);
+            return NULL;
+        }
+        if (stats != NULL) {
+            memset(stats, 0, sizeof(*stats));
+            Py_DECREF(type);
+        }
+    }
+    Py_SETREF(state->stats_types, listed);
+    Py_CLEAR(((SlotsTypeCacheObject *)state->type_cache)->counts);
+    Py_CLEAR(((SlotsShapeCacheObject *)state->shape_cache)->counts);
+    Py_RETURN_NONE;
+}
+
+
+typedef struct {
+    PyObject_HEAD
+    PyTypeObject *type;
+    SlotsLayoutObject *layout;
+    char **columns;
+    int *kinds;
+    Py_ssize_t length;
+    Py_ssize_t capacity;
+    Py_ssize_t exports;
+} SlotsArrayObject;
+
+
+typedef struct {
+    PyObject_HEAD
+    SlotsArrayObject *array;
+    Py_ssize_t index;
+} SlotsArrayViewObject;
+
+
+typedef struct {
+    PyObject_HEAD
+    SlotsArrayObject *array;
+    Py_ssize_t field;
+    Py_ssize_t shape;
+} SlotsArrayColumnObject;
+
+
+static inline char* _slots_array_cell(SlotsArrayObject *array, Py_ssize_t field, Py_ssize_t index) {
+    return array->columns[field] + index * _slots_native_size(array->kinds[field]);
+}
+
+
+static int _slots_array_reserve(SlotsArrayObject *array, Py_ssize_t capacity) {
+    // grows every column to hold capacity rows, never moving exported ones
+    if (capacity <= array->capacity) {
+        return 0;
     }
-    return value;
+    if (array->exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "Existing exports of data: object cannot be re-sized");
+        return -1;
+    }
+    for (Py_ssize_t i=0; i<array->layout->size; i++) {
+        Py_ssize_t size = _slots_native_size(array->kinds[i]);
+        char *column = PyMem_Realloc(array->columns[i], capacity * size);
+        if (column == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        memset(column + array->capacity * size, 0, (capacity - array->capacity) * size);
+        array->columns[i] = column;
+    }
+    array->capacity = capacity;
+    return 0;
 }
 
 
-static PyObject* _slots_factory_hash(PyObject *self, PyObject *args) {
-    Py_ssize_t n;
-
-    PyObject *dict;
-    PyListObject *keys;
-    
-    unsigned char *name;
-    unsigned long _hash;
+static SlotsArrayObject* _slots_array_new(PyTypeObject *type, Py_ssize_t capacity) {
+    SlotsLayoutObject *layout = _slots_layout_of(type);
+    if (layout == NULL || !layout->direct) {
+        PyErr_Format(PyExc_TypeError, "%.200s has no direct __slots_layout__ to store in columns", type->tp_name);
+        return NULL;
+    }
+    if (capacity < 0) {
+        PyErr_Format(PyExc_ValueError, "capacity must not be negative");
+        return NULL;
+    }
 
-    if (!PyArg_ParseTuple(args, "sO", &name, &dict)) {
+    SlotsFactoryState *state = _slots_state();
+    SlotsArrayObject *array = state == NULL ? NULL : PyObject_GC_New(SlotsArrayObject, state->array_type);
+    if (array == NULL) {
         return NULL;
     }
+    Py_INCREF(type);
+    Py_INCREF(layout);
+    array->type = type;
+    array->layout = layout;
+    array->length = 0;
+    array->capacity = 0;
+    array->exports = 0;
+    array->columns = PyMem_Calloc(layout->size ? layout->size : 1, sizeof(char *));
+    array->kinds = PyMem_Calloc(layout->size ? layout->size : 1, sizeof(int));
+    if (array->columns == NULL || array->kinds == NULL) {
+        Py_DECREF(array);
+        return (SlotsArrayObject *)PyErr_NoMemory();
+    }
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        array->kinds[i] = layout->members[i]->type;
+    }
+    PyObject_GC_Track(array);
 
-    _hash = hash(name);
+    if (_slots_array_reserve(array, capacity) == -1) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    return array;
+}
 
-    keys = PyDict_Keys(dict);
-    PyList_Sort(keys);
-    n = PyList_Size(keys);
 
-    for (Py_ssize_t i=0; i<n; i++) {
-        PyObject *key_object = PyList_GetItem(keys, i);
-        PyObject *encoded_key = PyUnicode_AsEncodedString(
-            key_object, "UTF-8", "strict"
+static int _slots_array_append(SlotsArrayObject *array, PyObject *instance) {
+    // copies the fields of instance into a new row, raw for native fields
+    if (Py_TYPE(instance) != array->type) {
+        PyErr_Format(
+            PyExc_TypeError, "expected %.200s, not %.200s",
+            array->type->tp_name, Py_TYPE(instance)->tp_name
         );
-        unsigned char *key = PyBytes_AsString(encoded_key);
-        unsigned long key_hash = hash(key);
-        _hash = _hash ^ key_hash;
+        return -1;
+    }
+    if (
+        array->length == array->capacity
+        && _slots_array_reserve(array, array->capacity + (array->capacity >> 1) + 8) == -1
+    ) {
+        return -1;
+    }
+    SlotsLayoutObject *layout = array->layout;
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        char *field = (char *)instance + layout->offsets[i];
+        char *cell = _slots_array_cell(array, i, array->length);
+        if (array->kinds[i] == T_OBJECT_EX) {
+            Py_XINCREF(*(PyObject **)field);
+            *(PyObject **)cell = *(PyObject **)field;
+        } else {
+            memcpy(cell, field, _slots_native_size(array->kinds[i]));
+        }
     }
+    array->length++;
+    return 0;
+}
 
-    return PyLong_FromUnsignedLong(_hash);
+
+static PyObject* _slots_array_load(SlotsArrayObject *array, Py_ssize_t field, Py_ssize_t index) {
+    // new reference to one cell, AttributeError when an object cell is unset
+    char *cell = _slots_array_cell(array, field, index);
+    if (array->kinds[field] != T_OBJECT_EX) {
+        return _slots_native_load(array->kinds[field], cell);
+    }
+    PyObject *value = *(PyObject **)cell;
+    if (value == NULL) {
+        return PyErr_Format(PyExc_AttributeError, "%U", PyTuple_GET_ITEM(array->layout->names, field));
+    }
+    Py_INCREF(value);
+    return value;
 }
 
 
-static PyObject* _slots_factory_setattrs_slim(PyObject *self, PyObject *args) {
-    // only uses args because it takes 30% longer to parse keywords
-    
-    PyObject *kwargs;
-    PyObject *instance;
-    int *check_flag;
+static int _slots_array_store(SlotsArrayObject *array, Py_ssize_t field, Py_ssize_t index, PyObject *value) {
+    char *cell = _slots_array_cell(array, field, index);
+    if (array->kinds[field] != T_OBJECT_EX) {
+        return _slots_native_store(array->kinds[field], cell, value);
+    }
+    Py_XINCREF(value);
+    Py_XSETREF(*(PyObject **)cell, value);
+    return 0;
+}
+
 
-    if (!PyArg_ParseTuple(args, "OOp", &instance, &kwargs, &check_flag)) {
+static PyObject* _slots_array_view(SlotsArrayObject *array, Py_ssize_t index) {
+    SlotsFactoryState *state = _slots_state();
+    SlotsArrayViewObject *view = state == NULL ? NULL : PyObject_New(SlotsArrayViewObject, state->array_view_type);
+    if (view == NULL) {
         return NULL;
     }
+    Py_INCREF(array);
+    view->array = array;
+    view->index = index;
+    return (PyObject *)view;
+}
 
-    if (check_flag == 1) {
-        PyObject *__slots__ = PyObject_GetAttrString(instance, "__slots__");
-        if (PyObject_Length(__slots__) != PyObject_Length(kwargs)) {
-            return PyErr_Format(PyExc_AttributeError, "Mismatch in number of attributes");
-        }
+
+static PyObject* _slots_array_tp_new(PyTypeObject *cls, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"type", "capacity", NULL};
+    PyObject *type;
+    Py_ssize_t capacity = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|n:SlotsArray", keywords, &PyType_Type, &type, &capacity)) {
+        return NULL;
     }
+    return (PyObject *)_slots_array_new((PyTypeObject *)type, capacity);
+}
 
-    PyObject *key, *value;
-    Py_ssize_t pos = 0;
-    while (PyDict_Next(kwargs, &pos, &key, &value)) {
 
-        if (PyObject_SetAttr(instance, key, value) == -1) {
-            return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
-        }
+static PyObject* _slots_array_append_method(SlotsArrayObject *array, PyObject *instance) {
+    if (_slots_array_append(array, instance) == -1) {
+        return NULL;
     }
+    Py_RETURN_NONE;
+}
 
-    Py_INCREF(Py_None);
-    return Py_None;
+
+static PyObject* _slots_array_extend(SlotsArrayObject *array, PyObject *iterable) {
+    PyObject *items = PySequence_Fast(iterable, "extend() argument must be iterable");
+    if (items == NULL) {
+        return NULL;
+    }
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(items);
+    int result = _slots_array_reserve(array, array->length + size);
+    for (Py_ssize_t i=0; result == 0 && i<size; i++) {
+        result = _slots_array_append(array, PySequence_Fast_GET_ITEM(items, i));
+    }
+    Py_DECREF(items);
+    if (result == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
 
-static PyObject* _slots_factory_setattrs(PyObject *self, PyObject *args) {
-    // only uses args because it takes 30% longer to parse keywords
-    PyObject *instance;
-    PyObject *_callables;
-    PyObject *_defaults;
-    PyObject *kwargs;
-    PyObject *_dependents;
+static Py_ssize_t _slots_array_field(SlotsArrayObject *array, PyObject *name) {
+    // the column of name, -1 with an exception if there is none
+    if (!PyUnicode_Check(name)) {
+        PyErr_Format(PyExc_TypeError, "field names must be strings");
+        return -1;
+    }
+    Py_ssize_t i = _slots_layout_find(array->layout, name, -1);
+    if (i < 0 && !PyErr_Occurred()) {
+        PyErr_Format(PyExc_KeyError, "%R", name);
+    }
+    return i;
+}
 
-    int *check_flag;
 
-    if (!PyArg_ParseTuple(args, "OOOOOp", &instance, &_callables, &_defaults, &kwargs, &_dependents, &check_flag)) {
+static PyObject* _slots_array_column(SlotsArrayObject *array, PyObject *name) {
+    // a memoryview over one native column, as it is now
+    Py_ssize_t i = _slots_array_field(array, name);
+    if (i < 0) {
+        return NULL;
+    }
+    if (array->kinds[i] == T_OBJECT_EX) {
+        return PyErr_Format(PyExc_TypeError, "only packed fields are stored in typed columns, not %R", name);
+    }
+    SlotsFactoryState *state = _slots_state();
+    SlotsArrayColumnObject *column = state == NULL ? NULL : PyObject_New(SlotsArrayColumnObject, state->array_column_type);
+    if (column == NULL) {
         return NULL;
     }
+    Py_INCREF(array);
+    column->array = array;
+    column->field = i;
+    column->shape = array->length;
+    PyObject *memoryview = PyMemoryView_FromObject((PyObject *)column);
+    Py_DECREF(column);
+    return memoryview;
+}
 
-    if (check_flag == 1) {
-        PyObject *__slots__ = PyObject_GetAttrString(instance, "__slots__");
-        if (PyObject_Length(__slots__) != PyObject_Length(kwargs)) {
-            return PyErr_Format(PyExc_AttributeError, "Mismatch in number of attributes");
-        }
+
+static Py_ssize_t _slots_array_len(SlotsArrayObject *array) {
+    return array->length;
+}
+
+
+static PyObject* _slots_array_item(SlotsArrayObject *array, Py_ssize_t index) {
+    if (index < 0 || index >= array->length) {
+        return PyErr_Format(PyExc_IndexError, "array index out of range");
     }
+    return _slots_array_view(array, index);
+}
 
-    PyObject *key, *value;
-    Py_ssize_t pos;
 
-    pos = 0;
-    if (PyObject_Length(_callables) > 0) {
-        while (PyDict_Next(_callables, &pos, &key, &value)) {
-            value = PyObject_CallObject(value, NULL);
-            if (PyObject_SetAttr(instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
-            }
+static PyObject* _slots_array_subscript(SlotsArrayObject *array, PyObject *key) {
+    if (PyIndex_Check(key)) {
+        Py_ssize_t index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (index == -1 && PyErr_Occurred()) {
+            return NULL;
         }
+        return _slots_array_item(array, index < 0 ? index + array->length : index);
+    }
+    if (!PySlice_Check(key)) {
+        return PyErr_Format(PyExc_TypeError, "array indices must be integers or slices, not %.200s", Py_TYPE(key)->tp_name);
     }
 
-    pos = 0;
-    if (PyObject_Length(_defaults) > 0) {
-        while (PyDict_Next(_defaults, &pos, &key, &value)) {
-            if (PyObject_SetAttr(instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
-            }
-        }
+    // slices copy their rows into a new array
+    Py_ssize_t start, stop, step;
+    if (PySlice_Unpack(key, &start, &stop, &step) == -1) {
+        return NULL;
     }
-    
-    pos = 0;
-    if (PyObject_Length(kwargs) > 0) {
-        while (PyDict_Next(kwargs, &pos, &key, &value)) {
-            if (PyObject_SetAttr(instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+    Py_ssize_t length = PySlice_AdjustIndices(array->length, &start, &stop, step);
+    SlotsArrayObject *result = _slots_array_new(array->type, length);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; i<array->layout->size; i++) {
+        Py_ssize_t size = _slots_native_size(array->kinds[i]);
+        for (Py_ssize_t j=0, k=start; j<length; j++, k+=step) {
+            char *cell = _slots_array_cell(array, i, k);
+            if (array->kinds[i] == T_OBJECT_EX) {
+                Py_XINCREF(*(PyObject **)cell);
             }
+            memcpy(_slots_array_cell(result, i, j), cell, size);
         }
     }
+    result->length = length;
+    return (PyObject *)result;
+}
 
-    pos = 0;
-    if (PyObject_Length(_dependents) > 0) {
-        while (PyDict_Next(_dependents, &pos, &key, &value)) {
-            value = PyObject_CallFunctionObjArgs(value, instance, NULL);
-            if (PyObject_SetAttr(instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set called attribute");
-            }
-        }
+
+static int _slots_array_getbuffer(SlotsArrayColumnObject *column, Py_buffer *view, int flags) {
+    SlotsArrayObject *array = column->array;
+    int kind = array->kinds[column->field];
+    Py_ssize_t size = _slots_native_size(kind);
+
+    if (column->shape > array->length) {
+        PyErr_SetString(PyExc_BufferError, "column is longer than its array");
+        return -1;
     }
+    view->obj = (PyObject *)column;
+    view->buf = array->columns[column->field];
+    view->len = column->shape * size;
+    view->readonly = 0;
+    view->itemsize = size;
+    view->format = (flags & PyBUF_FORMAT) ? (kind == T_DOUBLE ? "d" : kind == T_LONGLONG ? "q" : "?") : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &column->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &view->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    Py_INCREF(column);
+    array->exports++;
+    return 0;
+}
 
-    Py_INCREF(Py_None);
-    return Py_None;
+
+static void _slots_array_releasebuffer(SlotsArrayColumnObject *column, Py_buffer *view) {
+    column->array->exports--;
 }
 
 
-static PyObject* _slots_factory_setattrs_from_object(PyObject *self, PyObject *args) {
-    PyObject *object;
-    PyObject *instance;
-    PyObject *_callables;
-    PyObject *_defaults;
-    PyObject *kwargs;
-    PyObject *_dependents;
+static int _slots_array_traverse(SlotsArrayObject *array, visitproc visit, void *arg) {
+    SLOTS_VISIT_TYPE(array);
+    Py_VISIT(array->type);
+    Py_VISIT(array->layout);
+    for (Py_ssize_t i=0; array->columns != NULL && i<array->layout->size; i++) {
+        if (array->kinds[i] != T_OBJECT_EX) {
+            continue;
+        }
+        PyObject **column = (PyObject **)array->columns[i];
+        for (Py_ssize_t j=0; j<array->length; j++) {
+            Py_VISIT(column[j]);
+        }
+    }
+    return 0;
+}
+
 
-    if (!PyArg_ParseTuple(args, "OOOOOO", &object, &instance, &_callables, &_defaults, &kwargs, &_dependents)) {
-        return NULL;
+static int _slots_array_clear(SlotsArrayObject *array) {
+    for (Py_ssize_t i=0; array->columns != NULL && i<array->layout->size; i++) {
+        if (array->kinds[i] != T_OBJECT_EX) {
+            continue;
+        }
+        PyObject **column = (PyObject **)array->columns[i];
+        for (Py_ssize_t j=0; j<array->length; j++) {
+            Py_CLEAR(column[j]);
+        }
     }
+    return 0;
+}
 
-    PyObject *key, *value;
-    Py_ssize_t pos;
 
-    pos = 0;
-    if (PyObject_Length(_callables) > 0) {
-        while (PyDict_Next(_callables, &pos, &key, &value)) {
-            value = PyObject_CallObject(value, NULL);
-            if (PyObject_CallMethod(object, "__setattr__", "OOO", instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+static void _slots_array_dealloc(SlotsArrayObject *array) {
+    PyObject_GC_UnTrack(array);
+    _slots_array_clear(array);
+    for (Py_ssize_t i=0; array->columns != NULL && i<array->layout->size; i++) {
+        PyMem_Free(array->columns[i]);
+    }
+    PyMem_Free(array->columns);
+    PyMem_Free(array->kinds);
+    Py_XDECREF(array->layout);
+    Py_XDECREF(array->type);
+    PyTypeObject *type = Py_TYPE(array);
+    PyObject_GC_Del(array);
+    Py_DECREF(type);
+}
+
+
+static PyObject* _slots_array_view_getattro(SlotsArrayViewObject *view, PyObject *name) {
+    SlotsArrayObject *array = view->array;
+    if (PyUnicode_Check(name)) {
+        Py_ssize_t i = _slots_layout_find(array->layout, name, -1);
+        if (i >= 0) {
+            if (view->index >= array->length) {
+                return PyErr_Format(PyExc_IndexError, "array index out of range");
             }
+            return _slots_array_load(array, i, view->index);
+        }
+        if (PyErr_Occurred()) {
+            return NULL;
         }
     }
+    return PyObject_GenericGetAttr((PyObject *)view, name);
+}
 
-    pos = 0;
-    if (PyObject_Length(_defaults) > 0) {
-        while (PyDict_Next(_defaults, &pos, &key, &value)) {
-            if (PyObject_CallMethod(object, "__setattr__", "OOO", instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
-            }
+
+static int _slots_array_view_setattro(SlotsArrayViewObject *view, PyObject *name, PyObject *value) {
+    SlotsArrayObject *array = view->array;
+    Py_ssize_t i = PyUnicode_Check(name) ? _slots_layout_find(array->layout, name, -1) : -1;
+    if (i < 0) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
         }
+        return -1;
     }
-    
-    pos = 0;
-    if (PyObject_Length(kwargs) > 0) {
-        while (PyDict_Next(kwargs, &pos, &key, &value)) {
-            if (PyObject_CallMethod(object, "__setattr__", "OOO", instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
-            }
+    if (view->index >= array->length) {
+        PyErr_Format(PyExc_IndexError, "array index out of range");
+        return -1;
+    }
+    return _slots_array_store(array, i, view->index, value);
+}
+
+
+static PyObject* _slots_array_view_to_instance(SlotsArrayViewObject *view, PyObject *Py_UNUSED(ignored)) {
+    // a standalone instance of the row, written directly into its slots
+    SlotsArrayObject *array = view->array;
+    if (view->index >= array->length) {
+        return PyErr_Format(PyExc_IndexError, "array index out of range");
+    }
+    PyObject *instance = _slots_factory_alloc(array->type);
+    if (instance == NULL) {
+        return NULL;
+    }
+    SlotsLayoutObject *layout = array->layout;
+    for (Py_ssize_t i=0; i<layout->size; i++) {
+        char *cell = _slots_array_cell(array, i, view->index);
+        char *field = (char *)instance + layout->offsets[i];
+        if (array->kinds[i] == T_OBJECT_EX) {
+            Py_XINCREF(*(PyObject **)cell);
+            Py_XSETREF(*(PyObject **)field, *(PyObject **)cell);
+        } else {
+            memcpy(field, cell, _slots_native_size(array->kinds[i]));
         }
     }
+    return instance;
+}
 
-    pos = 0;
-    if (PyObject_Length(_dependents) > 0) {
-        while (PyDict_Next(_dependents, &pos, &key, &value)) {
-            value = PyObject_CallFunctionObjArgs(value, instance, NULL);
-            if (PyObject_CallMethod(object, "__setattr__", "OOO", instance, key, value) == -1) {
-                return PyErr_Format(PyExc_AttributeError, "Cannot set attribute");
+
+static PyObject* _slots_array_view_repr(SlotsArrayViewObject *view) {
+    SlotsArrayObject *array = view->array;
+    PyObject *fields = PyList_New(0);
+    if (fields == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i=0; view->index < array->length && i<array->layout->size; i++) {
+        PyObject *value = _slots_array_load(array, i, view->index);
+        PyObject *field = value == NULL ? NULL : PyUnicode_FromFormat(
+            "%U=%S", PyTuple_GET_ITEM(array->layout->names, i), value
+        );
+        Py_XDECREF(value);
+        if (field == NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                Py_DECREF(fields);
+                return NULL;
             }
+            PyErr_Clear();
+            continue;
         }
+        int result = PyList_Append(fields, field);
+        Py_DECREF(field);
+        if (result == -1) {
+            Py_DECREF(fields);
+            return NULL;
+        }
+    }
+    PyObject *separator = PyUnicode_FromString(", ");
+    PyObject *contents = separator == NULL ? NULL : PyUnicode_Join(separator, fields);
+    Py_XDECREF(separator);
+    Py_DECREF(fields);
+    if (contents == NULL) {
+        return NULL;
     }
+    PyObject *repr = PyUnicode_FromFormat("%s[%zd](%U)", _PyType_Name(array->type), view->index, contents);
+    Py_DECREF(contents);
+    return repr;
+}
+
+
+static void _slots_array_view_dealloc(SlotsArrayViewObject *view) {
+    Py_DECREF(view->array);
+    PyTypeObject *type = Py_TYPE(view);
+    PyObject_Del(view);
+    Py_DECREF(type);
+}
+
 
-    Py_INCREF(Py_None);
-    return Py_None;
+static void _slots_array_column_dealloc(SlotsArrayColumnObject *column) {
+    Py_DECREF(column->array);
+    PyTypeObject *type = Py_TYPE(column);
+    PyObject_Del(column);
+    Py_DECREF(type);
 }
 
 
+static PyMethodDef _slots_array_methods[] = {
+    {"append", (PyCFunction)_slots_array_append_method, METH_O, "append(instance): copies the fields of instance into a new row"},
+    {"extend", (PyCFunction)_slots_array_extend, METH_O, "extend(instances): appends each of instances"},
+    {"column", (PyCFunction)_slots_array_column, METH_O, "column(name): a memoryview over the typed column of a packed field"},
+    {NULL}
+};
+
+
+static PyMemberDef _slots_array_members[] = {
+    {"type", T_OBJECT, offsetof(SlotsArrayObject, type), READONLY, NULL},
+    {"capacity", T_PYSSIZET, offsetof(SlotsArrayObject, capacity), READONLY, NULL},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_array_slots[] = {
+    {Py_tp_doc, "SlotsArray(type, capacity=0): instances of one dataslots type, stored column by column"},
+    {Py_tp_new, _slots_array_tp_new},
+    {Py_tp_traverse, _slots_array_traverse},
+    {Py_tp_clear, _slots_array_clear},
+    {Py_tp_dealloc, _slots_array_dealloc},
+    {Py_tp_methods, _slots_array_methods},
+    {Py_tp_members, _slots_array_members},
+    {Py_sq_length, _slots_array_len},
+    {Py_sq_item, _slots_array_item},
+    {Py_mp_length, _slots_array_len},
+    {Py_mp_subscript, _slots_array_subscript},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsArraySpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.SlotsArray",
+    .basicsize = sizeof(SlotsArrayObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | SLOTS_TPFLAGS_IMMUTABLE,
+    .slots = _slots_array_slots,
+};
+
+
+static PyMethodDef _slots_array_view_methods[] = {
+    {"to_instance", (PyCFunction)_slots_array_view_to_instance, METH_NOARGS, "a standalone instance holding the fields of the row"},
+    {NULL}
+};
+
+
+static PyType_Slot _slots_array_view_slots[] = {
+    {Py_tp_doc, "a row of a SlotsArray, reading and writing its columns in place"},
+    {Py_tp_dealloc, _slots_array_view_dealloc},
+    {Py_tp_getattro, _slots_array_view_getattro},
+    {Py_tp_setattro, _slots_array_view_setattro},
+    {Py_tp_repr, _slots_array_view_repr},
+    {Py_tp_methods, _slots_array_view_methods},
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsArrayViewSpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.SlotsArrayView",
+    .basicsize = sizeof(SlotsArrayViewObject),
+    .flags = Py_TPFLAGS_DEFAULT | SLOTS_TPFLAGS_IMMUTABLE | SLOTS_TPFLAGS_NO_NEW,
+    .slots = _slots_array_view_slots,
+};
+
+
+static PyType_Slot _slots_array_column_slots[] = {
+    {Py_tp_doc, "buffer exporter for one typed column of a SlotsArray"},
+    {Py_tp_dealloc, _slots_array_column_dealloc},
+#if PY_VERSION_HEX >= 0x03090000
+    {Py_bf_getbuffer, _slots_array_getbuffer},
+    {Py_bf_releasebuffer, _slots_array_releasebuffer},
+#endif
+    {0, NULL}
+};
+
+
+static PyType_Spec SlotsArrayColumnSpec = {
+    .name = "slots_factory.tools.SlotsFactoryTools.SlotsArrayColumn",
+    .basicsize = sizeof(SlotsArrayColumnObject),
+    .flags = Py_TPFLAGS_DEFAULT | SLOTS_TPFLAGS_IMMUTABLE | SLOTS_TPFLAGS_NO_NEW,
+    .slots = _slots_array_column_slots,
+};
+
+
 static char _slots_factory_hash_docs[] = 
     "compute a hash as fast as possible.";
 
@@ -214,28 +5893,378 @@ static char _slots_factory_setattrs_slim_docs[] =
     "slimmed method for settings attrs from kwargs";
 
 
+static char _slots_factory_from_type_docs[] =
+    "slots_from_type(type_, **kwargs)\n--\n\n"
+    "Convenience function. Takes a type and kwargs, and instantiates the type\n"
+    "with kwargs assigned to corresponding attributes.\n\n"
+    ":param type_: type as derived from type_factory()\n"
+    ":type type_: type\n"
+    ":return: instance of the type, with assigned attributes\n"
+    ":rtype: SlotsObject";
+
+
 static char _slots_factory_setattrs_from_object_docs[] =
     "uses passed reference to object for setting attributes, as means of bypassing any frozen attributes";
 
 
+static char _slots_factory_layout_docs[] =
+    "resolves the member offsets of a type's __slots__ for direct attribute stores.";
+
+
+static char _slots_factory_methods_docs[] =
+    "installs the native __eq__, __hash__, rich comparisons and sort_key named in names on a type, reading slots by offset.";
+
+
+static char _slots_factory_pool_docs[] =
+    "gives a type a free list of up to n deallocated instances, recycled by its next allocations.";
+
+
+static char _slots_factory_untracked_docs[] =
+    "leaves the instances of a type, which must have none yet, out of cyclic GC.";
+
+static char _slots_factory_lazy_docs[] =
+    "turns object slots of a type into LazySlots, computed from self on first access.";
+
+
+static char _slots_factory_storage_docs[] =
+    "builds the base type storing the native int, float and bool fields of a packed type.";
+
+
+static char _slots_factory_classify_docs[] =
+    "sorts the __dict__ and __annotations__ of a class into the attrs, methods, callables, dependents, lazy slots and defaults of @dataslots.";
+
+
+static char _slots_factory_compiled_docs[] =
+    "builds the storage type of a schema compiled by slots_factory.compiler, checked against the slots and packed fields of a type.";
+
+
+static char _slots_factory_compiled_init_docs[] =
+    "lets a dataslots __init__ store through the compiled init of a schema.";
+
+
+static char _slots_factory_from_rows_docs[] =
+    "builds a list of instances of a dataslots type from an iterable of positional rows.";
+
+
+static char _slots_factory_from_columns_docs[] =
+    "builds a list of instances of a dataslots type from a dict of equal length columns.";
+
+
+static char _slots_factory_from_dict_docs[] =
+    "builds an instance of a dataslots type from a dict of attribute values.";
+
+static char _slots_factory_from_buffer_docs[] =
+    "builds an instance of a packed type from the struct_format record at an offset in a buffer.";
+
+static char _slots_factory_encode_docs[] =
+    "encodes an instance as its schema followed by its fields in slot order.";
+
+static char _slots_factory_encode_many_docs[] =
+    "encodes a sequence of instances behind a single schema and count.";
+
+static char _slots_factory_decode_docs[] =
+    "decodes an instance encoded for the same schema.";
+
+static char _slots_factory_decode_many_docs[] =
+    "decodes a list of instances encoded by encode_many for the same schema.";
+
+static char _slots_factory_rebuild_docs[] =
+    "rebuilds a pickled instance from its reduce key and slot values.";
+
+static char _slots_factory_rebuild_packed_docs[] =
+    "rebuilds a pickled instance of a packed type from its reduce key, native fields and object slot values.";
+
+
+static char _slots_factory_init_docs[] =
+    "builds a native __init__ bound to a type's callables, defaults and dependents.";
+
+
+static char _slots_factory_stats_docs[] =
+    "the counters kept while stats are on: per type, and per name for each cache.";
+
+static char _slots_factory_stats_enable_docs[] =
+    "turns the counters of this interpreter on or off, they cost a single load while off.";
+
+static char _slots_factory_stats_reset_docs[] =
+    "zeroes every counter.";
+
+
 static PyMethodDef SlotsFactoryToolsMethods[] = {
-    {"_slots_factory_hash", (PyCFunction)_slots_factory_hash, METH_VARARGS, _slots_factory_hash_docs},
-    {"_slots_factory_setattrs", (PyCFunction)_slots_factory_setattrs, METH_VARARGS, _slots_factory_setattrs_docs},
-    {"_slots_factory_setattrs_slim", (PyCFunction)_slots_factory_setattrs_slim, METH_VARARGS, _slots_factory_setattrs_slim_docs},
-    {"_slots_factory_setattrs_from_object", (PyCFunction)_slots_factory_setattrs_from_object, METH_VARARGS, _slots_factory_setattrs_from_object_docs}, 
+    {"_slots_factory_hash", (PyCFunction)(void(*)(void))_slots_factory_hash, METH_FASTCALL, _slots_factory_hash_docs},
+    {"_slots_factory_setattrs", (PyCFunction)(void(*)(void))_slots_factory_setattrs, METH_FASTCALL, _slots_factory_setattrs_docs},
+    {"_slots_factory_setattrs_slim", (PyCFunction)(void(*)(void))_slots_factory_setattrs_slim, METH_FASTCALL, _slots_factory_setattrs_slim_docs},
+    {"_slots_factory_setattrs_from_object", (PyCFunction)(void(*)(void))_slots_factory_setattrs_from_object, METH_FASTCALL, _slots_factory_setattrs_from_object_docs},
+    {"_slots_factory_from_type", (PyCFunction)(void(*)(void))_slots_factory_from_type, METH_FASTCALL | METH_KEYWORDS, _slots_factory_from_type_docs},
+    {"_slots_factory_layout", (PyCFunction)_slots_factory_layout, METH_O, _slots_factory_layout_docs},
+    {"_slots_factory_methods", (PyCFunction)(void(*)(void))_slots_factory_methods, METH_FASTCALL, _slots_factory_methods_docs},
+    {"_slots_factory_pool", (PyCFunction)(void(*)(void))_slots_factory_pool, METH_FASTCALL, _slots_factory_pool_docs},
+    {"_slots_factory_untracked", (PyCFunction)_slots_factory_untracked, METH_O, _slots_factory_untracked_docs},
+    {"_slots_factory_lazy", (PyCFunction)(void(*)(void))_slots_factory_lazy, METH_FASTCALL, _slots_factory_lazy_docs},
+    {"_slots_factory_storage", (PyCFunction)(void(*)(void))_slots_factory_storage, METH_FASTCALL, _slots_factory_storage_docs},
+    {"_slots_factory_classify", (PyCFunction)(void(*)(void))_slots_factory_classify, METH_FASTCALL, _slots_factory_classify_docs},
+    {"_slots_factory_compiled", (PyCFunction)(void(*)(void))_slots_factory_compiled, METH_FASTCALL, _slots_factory_compiled_docs},
+    {"_slots_factory_compiled_init", (PyCFunction)(void(*)(void))_slots_factory_compiled_init, METH_FASTCALL, _slots_factory_compiled_init_docs},
+    {"_slots_factory_init", (PyCFunction)(void(*)(void))_slots_factory_init, METH_FASTCALL, _slots_factory_init_docs},
+    {"_slots_factory_from_rows", (PyCFunction)(void(*)(void))_slots_factory_from_rows, METH_FASTCALL, _slots_factory_from_rows_docs},
+    {"_slots_factory_from_columns", (PyCFunction)(void(*)(void))_slots_factory_from_columns, METH_FASTCALL, _slots_factory_from_columns_docs},
+    {"_slots_factory_from_dict", (PyCFunction)(void(*)(void))_slots_factory_from_dict, METH_FASTCALL, _slots_factory_from_dict_docs},
+    {"_slots_factory_from_buffer", (PyCFunction)(void(*)(void))_slots_factory_from_buffer, METH_FASTCALL, _slots_factory_from_buffer_docs},
+    {"_slots_factory_encode", (PyCFunction)(void(*)(void))_slots_factory_encode, METH_FASTCALL, _slots_factory_encode_docs},
+    {"_slots_factory_encode_many", (PyCFunction)(void(*)(void))_slots_factory_encode_many, METH_FASTCALL, _slots_factory_encode_many_docs},
+    {"_slots_factory_decode", (PyCFunction)(void(*)(void))_slots_factory_decode, METH_FASTCALL, _slots_factory_decode_docs},
+    {"_slots_factory_decode_many", (PyCFunction)(void(*)(void))_slots_factory_decode_many, METH_FASTCALL, _slots_factory_decode_many_docs},
+    {"_slots_factory_rebuild", (PyCFunction)(void(*)(void))_slots_factory_rebuild, METH_FASTCALL, _slots_factory_rebuild_docs},
+    {"_slots_factory_rebuild_packed", (PyCFunction)(void(*)(void))_slots_factory_rebuild_packed, METH_FASTCALL, _slots_factory_rebuild_packed_docs},
+    {"_slots_factory_stats", (PyCFunction)_slots_factory_stats, METH_NOARGS, _slots_factory_stats_docs},
+    {"_slots_factory_stats_enable", (PyCFunction)_slots_factory_stats_enable, METH_O, _slots_factory_stats_enable_docs},
+    {"_slots_factory_stats_reset", (PyCFunction)_slots_factory_stats_reset, METH_NOARGS, _slots_factory_stats_reset_docs},
     {NULL, NULL, 0, NULL}
 };
 
 
+static inline SlotsFactoryState* _slots_factory_state(PyObject *module) {
+    return (SlotsFactoryState *)PyModule_GetState(module);
+}
+
+
+static PyTypeObject* _slots_factory_new_type(PyType_Spec *spec) {
+    // a new heap type from spec, filling in what older specs can't say
+    PyTypeObject *type = (PyTypeObject *)PyType_FromSpec(spec);
+    if (type == NULL) {
+        return NULL;
+    }
+#if PY_VERSION_HEX < 0x030A0000
+    // without Py_TPFLAGS_DISALLOW_INSTANTIATION, types with no Py_tp_new of
+    // their own drop the object.__new__ they inherited
+    int instantiable = 0;
+    for (PyType_Slot *slot = spec->slots; slot->slot; slot++) {
+        instantiable |= slot->slot == Py_tp_new;
+    }
+    if (!instantiable) {
+        type->tp_new = NULL;
+    }
+#endif
+    return type;
+}
+
+
+static int _slots_factory_add_type(PyObject *module, const char *name, PyType_Spec *spec, PyTypeObject **slot) {
+    // a new type from spec, kept in the module state and, given a name, as
+    // an attribute
+    *slot = _slots_factory_new_type(spec);
+    if (*slot == NULL) {
+        return -1;
+    }
+    if (name == NULL) {
+        return 0;
+    }
+    Py_INCREF(*slot);
+    if (PyModule_AddObject(module, name, (PyObject *)*slot) < 0) {
+        Py_DECREF(*slot);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int _slots_factory_add_cache(PyObject *module, const char *name, PyTypeObject *type, PyObject **slot) {
+    // a new cache of type, kept in the module state and as an attribute
+    *slot = PyObject_CallObject((PyObject *)type, NULL);
+    if (*slot == NULL) {
+        return -1;
+    }
+    Py_INCREF(*slot);
+    if (PyModule_AddObject(module, name, *slot) < 0) {
+        Py_DECREF(*slot);
+        return -1;
+    }
+    return 0;
+}
+
+
+#define SLOTS_FACTORY_STATE_OBJECTS(state) \
+    ((PyObject **)&(state)->layout_type)
+#define SLOTS_FACTORY_STATE_SIZE \
+    ((offsetof(SlotsFactoryState, pool_last) - offsetof(SlotsFactoryState, layout_type)) / sizeof(PyObject *))
+
+
+static int _slots_factory_share(PyObject *module, PyObject *owner) {
+    // a module executed again in the same interpreter, by a reimport after
+    // sys.modules dropped it, shares the types and caches of the first:
+    // instances and pickles must keep meaning the same thing
+    SlotsFactoryState *state = _slots_factory_state(module);
+    SlotsFactoryState *shared = _slots_factory_state(owner);
+    PyObject **objects = SLOTS_FACTORY_STATE_OBJECTS(state);
+    for (size_t i=0; i<SLOTS_FACTORY_STATE_SIZE; i++) {
+        objects[i] = SLOTS_FACTORY_STATE_OBJECTS(shared)[i];
+        Py_XINCREF(objects[i]);
+    }
+    // pickle insists that the reconstructors be the ones sys.modules has now
+    Py_XSETREF(shared->rebuild, PyObject_GetAttrString(module, "_slots_factory_rebuild"));
+    Py_XSETREF(shared->rebuild_packed, PyObject_GetAttrString(module, "_slots_factory_rebuild_packed"));
+    if (shared->rebuild == NULL || shared->rebuild_packed == NULL) {
+        return -1;
+    }
+    const char *names[] = {
+        "SlotsLayout", "SlotsInit", "LazySlot", "TypeCache", "ShapeCache", "SlotsArray",
+        "type_cache", "shape_cache",
+    };
+    PyObject *values[] = {
+        (PyObject *)state->layout_type, (PyObject *)state->init_type, (PyObject *)state->lazy_type,
+        (PyObject *)state->type_cache_type, (PyObject *)state->shape_cache_type,
+        (PyObject *)state->array_type, state->type_cache, state->shape_cache,
+    };
+    for (size_t i=0; i<sizeof(names) / sizeof(names[0]); i++) {
+        Py_INCREF(values[i]);
+        if (PyModule_AddObject(module, names[i], values[i]) < 0) {
+            Py_DECREF(values[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int _slots_factory_exec(PyObject *module) {
+    PyObject *interp = PyInterpreterState_GetDict(PyInterpreterState_Get());
+    if (interp == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "no interpreter dict to keep SlotsFactoryTools in");
+        return -1;
+    }
+    PyObject *owner = PyDict_GetItemString(interp, SLOTS_STATE_KEY);
+    if (owner != NULL) {
+        return _slots_factory_share(module, owner);
+    }
+
+    SlotsFactoryState *state = _slots_factory_state(module);
+    if (
+        _slots_factory_add_type(module, "SlotsLayout", &SlotsLayoutSpec, &state->layout_type) == -1
+        || _slots_factory_add_type(module, "SlotsInit", &SlotsInitSpec, &state->init_type) == -1
+        || _slots_factory_add_type(module, "LazySlot", &SlotsLazySpec, &state->lazy_type) == -1
+        || _slots_factory_add_type(module, "TypeCache", &SlotsTypeCacheSpec, &state->type_cache_type) == -1
+        || _slots_factory_add_type(module, "ShapeCache", &SlotsShapeCacheSpec, &state->shape_cache_type) == -1
+        || _slots_factory_add_type(module, "SlotsArray", &SlotsArraySpec, &state->array_type) == -1
+        || _slots_factory_add_type(module, NULL, &SlotsArrayViewSpec, &state->array_view_type) == -1
+        || _slots_factory_add_type(module, NULL, &SlotsArrayColumnSpec, &state->array_column_type) == -1
+        || _slots_factory_add_cache(module, "type_cache", state->type_cache_type, &state->type_cache) == -1
+        || _slots_factory_add_cache(module, "shape_cache", state->shape_cache_type, &state->shape_cache) == -1
+    ) {
+        return -1;
+    }
+#if PY_VERSION_HEX < 0x03090000
+    // 3.8 specs have no members for these offsets nor slots for buffers
+    state->init_type->tp_vectorcall_offset = offsetof(SlotsInitObject, vectorcall);
+    state->init_type->tp_dictoffset = offsetof(SlotsInitObject, dict);
+    ((PyHeapTypeObject *)state->array_column_type)->as_buffer.bf_getbuffer = (getbufferproc)_slots_array_getbuffer;
+    ((PyHeapTypeObject *)state->array_column_type)->as_buffer.bf_releasebuffer = (releasebufferproc)_slots_array_releasebuffer;
+#endif
+
+    state->slots_layout = PyUnicode_InternFromString("__slots_layout__");
+    state->slots_packed = PyUnicode_InternFromString("__slots_packed__");
+    state->init = PyUnicode_InternFromString("__init__");
+    state->struct_format = PyUnicode_InternFromString("struct_format");
+    state->struct_size = PyUnicode_InternFromString("struct_size");
+    state->class_dict = PyUnicode_InternFromString("__dict__");
+    state->class_annotations = PyUnicode_InternFromString("__annotations__");
+    state->method_names = _slots_object_method_names();
+    state->registry = PyDict_New();
+    state->nonce = _slots_registry_nonce();
+    state->stats_types = PyList_New(0);
+    // the reconstructors __reduce__ hands to pickle, found by their names
+    // in this module when loading
+    state->rebuild = PyObject_GetAttrString(module, "_slots_factory_rebuild");
+    state->rebuild_packed = PyObject_GetAttrString(module, "_slots_factory_rebuild_packed");
+    if (
+        state->slots_layout == NULL || state->slots_packed == NULL || state->init == NULL
+        || state->struct_format == NULL || state->struct_size == NULL || state->registry == NULL
+        || PyErr_Occurred()
+        || state->class_dict == NULL || state->class_annotations == NULL || state->method_names == NULL
+        || state->stats_types == NULL || state->rebuild == NULL || state->rebuild_packed == NULL
+    ) {
+        return -1;
+    }
+    // the first module executed in an interpreter is the one every call
+    // finds its state through
+    if (PyDict_SetItemString(interp, SLOTS_STATE_KEY, module) == -1) {
+        return -1;
+    }
+    if (!SLOTS_STATE_CLAIM(state)) {
+        _slots_state_only = SLOTS_STATE_SHARED;
+    }
+    return 0;
+}
+
+
+static int _slots_factory_traverse(PyObject *module, visitproc visit, void *arg) {
+    SlotsFactoryState *state = _slots_factory_state(module);
+    // 3.8 traverses, clears and frees modules whose state isn't allocated yet
+    if (state == NULL) {
+        return 0;
+    }
+    PyObject **objects = SLOTS_FACTORY_STATE_OBJECTS(state);
+    for (size_t i=0; i<SLOTS_FACTORY_STATE_SIZE; i++) {
+        Py_VISIT(objects[i]);
+    }
+    return 0;
+}
+
+
+static int _slots_factory_clear(PyObject *module) {
+    SlotsFactoryState *state = _slots_factory_state(module);
+    if (state == NULL) {
+        return 0;
+    }
+    PyObject **objects = SLOTS_FACTORY_STATE_OBJECTS(state);
+    for (size_t i=0; i<SLOTS_FACTORY_STATE_SIZE; i++) {
+        Py_CLEAR(objects[i]);
+    }
+    state->pool_last = NULL;
+    return 0;
+}
+
+
+static void _slots_factory_free(void *module) {
+    SlotsFactoryState *state = _slots_factory_state((PyObject *)module);
+    if (state == NULL) {
+        return;
+    }
+    _slots_factory_clear((PyObject *)module);
+    if (state->stats) {
+        SLOTS_STATS_ACTIVE_ADD(-1);
+    }
+    if (_slots_state_only == state) {
+        _slots_state_only = SLOTS_STATE_SHARED;
+    }
+    _slots_state_generation++;
+}
+
+
+static PyModuleDef_Slot SlotsFactoryToolsSlots[] = {
+    {Py_mod_exec, _slots_factory_exec},
+#if PY_VERSION_HEX >= 0x030C0000
+    // types, caches and names are all kept per interpreter
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    // the caches are safe without the GIL, pools and arrays aren't yet
+    {Py_mod_gil, Py_MOD_GIL_USED},
+#endif
+    {0, NULL}
+};
+
+
 static struct PyModuleDef SlotsFactoryTools = {
     PyModuleDef_HEAD_INIT,
-    "SlotsFactoryTools",
-    NULL,
-    -1,
-    SlotsFactoryToolsMethods
+    .m_name = "SlotsFactoryTools",
+    .m_size = sizeof(SlotsFactoryState),
+    .m_methods = SlotsFactoryToolsMethods,
+    .m_slots = SlotsFactoryToolsSlots,
+    .m_traverse = _slots_factory_traverse,
+    .m_clear = _slots_factory_clear,
+    .m_free = _slots_factory_free,
 };
 
 
 PyMODINIT_FUNC PyInit_SlotsFactoryTools(void) {
-    return PyModule_Create(&SlotsFactoryTools);
-}
\ No newline at end of file
+    return PyModuleDef_Init(&SlotsFactoryTools);
+}
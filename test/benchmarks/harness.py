@@ -0,0 +1,143 @@
+"""a small pyperf-style runner for the benchmarks in this directory.
+
+Each benchmark is calibrated to a number of loops per run, warmed up, then
+timed over several runs. The median, standard deviation and every run are
+written to a JSON file, and compared against a baseline file from an earlier
+run when there is one. Only a slowdown beyond both the tolerance and the
+noise of the two runs, in the median and the fastest run alike, fails.
+Absolute times are never asserted.
+
+Environment:
+    SLOTS_BENCH_OUTPUT      results file, .benchmarks/latest.json
+    SLOTS_BENCH_BASELINE    file to compare against, .benchmarks/baseline.json
+    SLOTS_BENCH_RUNS        timed runs per benchmark, 10
+    SLOTS_BENCH_WARMUPS     untimed runs first, 1
+    SLOTS_BENCH_TOLERANCE   allowed slowdown of the median, 0.10
+"""
+
+import gc
+import json
+import os
+import platform
+import statistics
+import sys
+import timeit
+import tracemalloc
+
+OUTPUT = os.environ.get("SLOTS_BENCH_OUTPUT", os.path.join(".benchmarks", "latest.json"))
+BASELINE = os.environ.get("SLOTS_BENCH_BASELINE", os.path.join(".benchmarks", "baseline.json"))
+RUNS = int(os.environ.get("SLOTS_BENCH_RUNS", 10))
+WARMUPS = int(os.environ.get("SLOTS_BENCH_WARMUPS", 1))
+TOLERANCE = float(os.environ.get("SLOTS_BENCH_TOLERANCE", 0.10))
+
+# each run lasts about this long, in seconds
+RUN_TIME = 0.05
+
+
+def _load(path):
+    try:
+        with open(path) as f:
+            return json.load(f)["benchmarks"]
+    except (OSError, ValueError, KeyError):
+        return {}
+
+
+_results = {}
+_baseline = _load(BASELINE)
+
+
+def _save():
+    directory = os.path.dirname(OUTPUT)
+    if directory:
+        os.makedirs(directory, exist_ok=True)
+    document = {
+        "python": sys.version.split()[0],
+        "implementation": platform.python_implementation(),
+        "machine": platform.machine(),
+        "benchmarks": _results,
+    }
+    with open(OUTPUT + ".tmp", "w") as f:
+        json.dump(document, f, indent=2, sort_keys=True)
+    os.replace(OUTPUT + ".tmp", OUTPUT)
+
+
+def _record(name, result):
+    _results[name] = result
+    _save()
+    line = f"{name}: {result['median']:.1f} {result['unit']}"
+    if result.get("stdev") is not None:
+        line += f" +- {result['stdev']:.1f}"
+    base = _baseline.get(name)
+    if base is not None and base["unit"] == result["unit"]:
+        line += f" (baseline {base['median']:.1f}, {result['median'] / base['median']:.2f}x)"
+    print(line)
+    return result
+
+
+def _calibrate(timer):
+    # loops doubling until one run is long enough to time reliably
+    loops = 1
+    while True:
+        elapsed = timer.timeit(loops)
+        if elapsed >= RUN_TIME / 10:
+            return max(1, int(loops * RUN_TIME / elapsed))
+        loops *= 2
+
+
+def bench(name, stmt, namespace):
+    """times stmt in namespace, in ns per loop, and checks it against the
+    baseline"""
+    timer = timeit.Timer(stmt, globals=namespace)
+    loops = _calibrate(timer)
+    for _ in range(WARMUPS):
+        timer.timeit(loops)
+    runs = []
+    enabled = gc.isenabled()
+    gc.disable()
+    try:
+        for _ in range(RUNS):
+            runs.append(timer.timeit(loops) / loops * 1e9)
+    finally:
+        if enabled:
+            gc.enable()
+    result = _record(name, {
+        "unit": "ns",
+        "median": statistics.median(runs),
+        "stdev": statistics.stdev(runs) if len(runs) > 1 else 0.0,
+        "min": min(runs),
+        "loops": loops,
+        "runs": runs,
+    })
+    check(name, result)
+    return result
+
+
+def memory(name, factory, count=10_000):
+    """bytes traced per instance, for count instances made by factory"""
+    gc.collect()
+    tracemalloc.start()
+    before = tracemalloc.get_traced_memory()[0]
+    instances = [factory() for _ in range(count)]
+    # the list itself is not part of the instances
+    size = tracemalloc.get_traced_memory()[0] - before - sys.getsizeof(instances)
+    tracemalloc.stop()
+    del instances
+    result = _record(name, {"unit": "B", "median": size / count, "stdev": None})
+    check(name, result)
+    return result
+
+
+def check(name, result):
+    """fails when result is slower, or bigger, than its baseline by more than
+    the tolerance and the noise of both. A real regression slows every run,
+    so the fastest run has to be over the limit as well as the median"""
+    base = _baseline.get(name)
+    if base is None or base["unit"] != result["unit"]:
+        return
+    noise = 2 * max(result["stdev"] or 0.0, base.get("stdev") or 0.0)
+    limit = max(base["median"] * (1 + TOLERANCE), base["median"] + noise)
+    fastest = result.get("min", result["median"])
+    assert result["median"] <= limit or fastest <= limit, (
+        f"{name} regressed: {result['median']:.1f} {result['unit']}"
+        f" against a baseline of {base['median']:.1f}"
+    )
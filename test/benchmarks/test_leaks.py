@@ -0,0 +1,177 @@
+"""leak and allocation regression checks. Each path runs ITERATIONS times
+after a warm up, and the live blocks, references (debug builds only) and
+traced memory it leaves behind are scaled to a million calls. A leak of a
+single object per call shows up as a million blocks, so the bounds only
+leave room for free lists and caches settling"""
+
+import copy
+import gc
+import pickle
+import sys
+import tracemalloc
+
+from slots_factory import dataslots, fast_slots, lazy, slots_factory, slots_from_dict, stats, type_factory
+from slots_factory.tools.SlotsFactoryTools import (
+    _slots_factory_hash,
+    _slots_factory_setattrs,
+    _slots_factory_setattrs_from_object,
+    _slots_factory_setattrs_slim,
+)
+
+ITERATIONS = 100_000
+PER_MILLION = 1_000_000 // ITERATIONS
+
+# per million calls
+MAX_BLOCKS = 10_000
+MAX_REFS = 10_000
+MAX_TRACED = 1_000_000
+
+
+def _leaked(f):
+    for _ in range(1_000):
+        f()
+    gc.collect()
+    refs = getattr(sys, "gettotalrefcount", lambda: 0)()
+    blocks = sys.getallocatedblocks()
+    tracemalloc.start()
+    traced = tracemalloc.get_traced_memory()[0]
+    for _ in range(ITERATIONS):
+        f()
+    gc.collect()
+    traced = tracemalloc.get_traced_memory()[0] - traced
+    tracemalloc.stop()
+    blocks = sys.getallocatedblocks() - blocks
+    refs = getattr(sys, "gettotalrefcount", lambda: 0)() - refs
+    return blocks * PER_MILLION, refs * PER_MILLION, traced * PER_MILLION
+
+
+def _assert_no_leak(f):
+    blocks, refs, traced = _leaked(f)
+    assert blocks < MAX_BLOCKS, f"{blocks} blocks per million calls"
+    assert refs < MAX_REFS, f"{refs} references per million calls"
+    assert traced < MAX_TRACED, f"{traced} bytes per million calls"
+
+
+def _raises(f, *args, **kwargs):
+    def call():
+        try:
+            f(*args, **kwargs)
+        except (AttributeError, TypeError, ValueError):
+            pass
+    return call
+
+
+@dataslots
+class This:
+    x: int = 1
+    y: list = lambda: []
+    z: int = lambda self: self.x + 1
+
+
+@dataslots(frozen=True, order=True)
+class Frozen:
+    x: int = 1
+    y: str = "y"
+
+
+@dataslots(packed=True)
+class Packed:
+    x: int = 1
+    y: float = 2.0
+    name: str = "packed"
+
+
+@dataslots(packed=True)
+class Reading:
+    x: int = 1
+    y: float = 2.0
+
+
+@dataslots
+class Lazy:
+    x: int = 1
+    y: int = lazy(lambda self: self.x * 2)
+
+
+class Plain:
+    __slots__ = ("x", "y")
+
+
+class TestConstructionLeaks:
+    def test_hash(self):
+        _assert_no_leak(lambda: _slots_factory_hash("SlotsObject", {"x": 1, "y": 2}))
+
+    def test_slots_factory(self):
+        _assert_no_leak(lambda: slots_factory(x=1, y=2))
+
+    def test_fast_slots(self):
+        _assert_no_leak(lambda: fast_slots(x=1, y=2))
+
+    def test_slots_from_dict(self):
+        _assert_no_leak(lambda: slots_from_dict({"x": 1, "y": 2}))
+
+    def test_dataslots(self):
+        _assert_no_leak(lambda: This())
+        _assert_no_leak(lambda: This(x=2, y=[]))
+        _assert_no_leak(lambda: Frozen(x=2))
+        _assert_no_leak(lambda: Packed(x=2, name="name"))
+        _assert_no_leak(lambda: Lazy().y)
+
+    def test_stats(self):
+        stats.enable()
+        try:
+            _assert_no_leak(lambda: This())
+            _assert_no_leak(lambda: slots_factory(x=1, y=2))
+            _assert_no_leak(lambda: fast_slots(x=1, y=2))
+            _assert_no_leak(lambda: stats())
+        finally:
+            stats.disable()
+            stats.reset()
+
+    def test_setattrs(self):
+        _type = type_factory(("x", "y"))
+        plain = Plain()
+        _assert_no_leak(lambda: _slots_factory_setattrs_slim(_type(), {"x": 1, "y": 2}, True))
+        _assert_no_leak(lambda: _slots_factory_setattrs_slim(plain, {"x": 1, "y": 2}, True))
+        _assert_no_leak(lambda: _slots_factory_setattrs(
+            _type(), {"x": list}, {}, {"y": 2}, {}, False
+        ))
+        _assert_no_leak(lambda: _slots_factory_setattrs(
+            plain, {"x": list}, {}, {}, {"y": lambda self: self.x}, False
+        ))
+        _assert_no_leak(lambda: _slots_factory_setattrs_from_object(
+            object, plain, {"x": list}, {}, {}, {"y": lambda self: self.x}
+        ))
+
+    def test_errors(self):
+        _type = type_factory(("x", "y"))
+        _assert_no_leak(_raises(_slots_factory_setattrs_slim, _type(), {"x": 1}, True))
+        _assert_no_leak(_raises(_slots_factory_setattrs_slim, Plain(), {"x": 1}, True))
+        _assert_no_leak(_raises(This, w=1))
+        _assert_no_leak(_raises(Frozen().__setattr__, "x", 2))
+        _assert_no_leak(_raises(This.decode, b"\x00"))
+
+
+class TestInstanceLeaks:
+    def test_copies(self):
+        this = This()
+        _assert_no_leak(lambda: this.replace(x=3))
+        _assert_no_leak(lambda: copy.copy(this))
+        _assert_no_leak(lambda: copy.deepcopy(this))
+
+    def test_comparisons(self):
+        one, two = Frozen(x=1), Frozen(x=2)
+        _assert_no_leak(lambda: (one == two, one < two, hash(one)))
+        _assert_no_leak(lambda: repr(one))
+
+    def test_serialization(self):
+        this, packed, reading = This(), Packed(), Reading()
+        _assert_no_leak(lambda: pickle.loads(pickle.dumps(this)))
+        _assert_no_leak(lambda: pickle.loads(pickle.dumps(packed, 5)))
+        _assert_no_leak(lambda: This.decode(This.encode(this)))
+        _assert_no_leak(lambda: Reading.from_buffer(bytes(reading)))
+
+    def test_batches(self):
+        rows = [(i,) for i in range(10)]
+        _assert_no_leak(lambda: This.from_rows(rows))
+        _assert_no_leak(lambda: This.from_columns({"x": list(range(10))}))
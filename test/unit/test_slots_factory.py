@@ -1,18 +1,38 @@
+import copy
+import ctypes
+import gc
+import os
+import pickle
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import weakref
+
 import pytest
 
 from slots_factory import (
+    lazy,
     slots_factory,
     fast_slots,
     slots_from_type,
     type_factory,
     slots_from_dict,
     dataslots,
+    stats,
 )
+from slots_factory import compiler
 
 
 from slots_factory.tools.SlotsFactoryTools import (
+    SlotsInit,
+    TypeCache,
+    ShapeCache,
     _slots_factory_hash,
     _slots_factory_setattrs_slim,
+    _slots_factory_setattrs_from_object,
 )
 
 
@@ -74,6 +94,90 @@ class TestTools:
         assert e.type == AttributeError
         assert e.value.args == ("Mismatch in number of attributes",)
 
+    def test_fastcall_arguments(self, type_):
+        instance = type_()
+        with pytest.raises(TypeError):
+            _slots_factory_setattrs_slim(instance, {"x": 1})
+        with pytest.raises(TypeError):
+            _slots_factory_setattrs_slim(instance, [("x", 1)], False)
+        with pytest.raises(TypeError):
+            _slots_factory_hash("SlotsObject")
+        with pytest.raises(TypeError):
+            _slots_factory_hash("SlotsObject", [("x", 1)])
+        with pytest.raises(TypeError):
+            _slots_factory_hash("SlotsObject", {1: 1})
+
+    def test_isolated_interpreter(self):
+        interpreters = None
+        for name in ("_interpreters", "_xxsubinterpreters"):
+            try:
+                interpreters = __import__(name)
+                break
+            except ImportError:
+                pass
+        if interpreters is None or sys.version_info < (3, 12):
+            pytest.skip("no interpreters with their own GIL")
+        script = (
+            "from slots_factory import dataslots, fast_slots\n"
+            "@dataslots\n"
+            "class This:\n"
+            "    x: int = 1\n"
+            "    y: str = 'y'\n"
+            "this = This(x=2)\n"
+            "assert this.replace(x=3) == This(x=3, y='y')\n"
+            "assert fast_slots(a=1, b=2).b == 2\n"
+        )
+        if name == "_interpreters":
+            interpreter = interpreters.create()
+        else:
+            interpreter = interpreters.create(isolated=True)
+        try:
+            assert interpreters.run_string(interpreter, script) is None
+        finally:
+            interpreters.destroy(interpreter)
+        assert fast_slots(a=1, b=2).b == 2
+
+    def test_reimport(self):
+        # a second module object in the same interpreter shares the first one's types
+        script = (
+            "import pickle, sys, importlib; from slots_factory import fast_slots\n"
+            "from slots_factory.tools import SlotsFactoryTools as first\n"
+            "del sys.modules[first.__name__]\n"
+            "second = importlib.import_module(first.__name__)\n"
+            "assert second is not first and second.SlotsLayout is first.SlotsLayout\n"
+            "print(pickle.loads(pickle.dumps(fast_slots(_name='This', a=1))))\n"
+        )
+        result = subprocess.run(
+            [sys.executable, "-c", script], capture_output=True, check=True,
+            env={**os.environ, "PYTHONPATH": os.pathsep.join(sys.path)},
+        )
+        assert result.stdout.strip() == b"This(a=1)"
+
+
+class TestSlotsLayout:
+    def test_layout(self, type_):
+        layout = type_.__slots_layout__
+        assert layout.names == ("x", "y", "z")
+        assert layout.direct
+
+    def test_custom_setattr(self):
+        seen = []
+
+        def __setattr__(self, key, value):
+            seen.append(key)
+            object.__setattr__(self, key, value)
+
+        _type = type_factory(("x", "y"), _methods={"__setattr__": __setattr__})
+        instance = slots_from_type(_type, x=1, y=2)
+        assert (instance.x, instance.y) == (1, 2)
+        assert seen == ["x", "y"]
+
+    def test_unknown_attribute(self, type_):
+        instance = type_()
+        with pytest.raises(AttributeError) as e:
+            _slots_factory_setattrs_slim(instance, {"a": 1}, False)
+        assert e.value.args == ("Cannot set attribute",)
+
 
 class TestSlotsFactory:
     def test_slots_factory(self):
@@ -83,14 +187,79 @@ class TestSlotsFactory:
         assert repr(instance) == "SlotsObject(x=1, y=2)"
 
     def test_caching(self):
-        _, _ = slots_factory(x=1, y=2), slots_factory(x=1, y=2)
-        assert len(slots_factory.__dict__) == 1
-
-        _ = slots_factory("fizz", x=1, y=2)
-        assert len(slots_factory.__dict__) == 2
-
-        _ = slots_factory(x=1, y=2, z=3)
-        assert len(slots_factory.__dict__) == 3
+        # the cache is shared by every test, only the types added here count
+        start = len(slots_factory.cache)
+        _, _ = slots_factory(caching_x=1, caching_y=2), slots_factory(caching_x=1, caching_y=2)
+        assert len(slots_factory.cache) == start + 1
+
+        _ = slots_factory("fizz", caching_x=1, caching_y=2)
+        assert len(slots_factory.cache) == start + 2
+
+        _ = slots_factory(caching_x=1, caching_y=2, caching_z=3)
+        assert len(slots_factory.cache) == start + 3
+
+        assert type(slots_factory(y=1, x=2)) is type(slots_factory(x=1, y=2))
+
+    def test_type_cache(self):
+        cache = TypeCache()
+        one, two = object(), object()
+        assert cache.get("A", {"x": 1}) is None
+
+        assert cache.set("A", {"x": 1, "y": 2}, one) is one
+        assert cache.set("A", {"x": 1}, two) is two
+        assert cache.get("A", {"y": 0, "x": 0}) is one
+        assert cache.get("A", {"x": 0}) is two
+        assert cache.get("B", {"x": 0}) is None
+        assert cache.get("A", {"x": 0, "z": 0}) is None
+
+        for i in range(100):
+            cache.set("A", {f"k{i}": 0}, i)
+        assert len(cache) == 102
+        assert all(cache.get("A", {f"k{i}": 0}) == i for i in range(100))
+
+        cache.clear()
+        assert len(cache) == 0
+        assert cache.get("A", {"x": 0}) is None
+
+    def test_get_or_build(self):
+        for cache_type in (TypeCache, ShapeCache):
+            self._check_get_or_build(cache_type())
+
+    def _check_get_or_build(self, cache):
+        built, results = [], []
+
+        def build():
+            built.append(threading.get_ident())
+            time.sleep(0.01)
+            return object()
+
+        threads = [
+            threading.Thread(target=lambda: results.append(cache.get_or_build("A", {"x": 0}, build)))
+            for _ in range(8)
+        ]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        assert len(built) == 1 and len(results) == 8
+        assert all(result is results[0] for result in results)
+        assert cache.get("A", {"x": 1}) is results[0]
+
+        # a build may need other types of the same cache
+        inner = lambda: cache.get_or_build("B", {"y": 0}, object)
+        outer = cache.get_or_build("C", {"z": 0}, lambda: (inner(), object())[1])
+        assert cache.get("B", {"y": 0}) is not None and cache.get("C", {"z": 0}) is outer
+
+        with pytest.raises(ZeroDivisionError):
+            cache.get_or_build("D", {}, lambda: 1 / 0)
+        assert cache.get("D", {}) is None
+        assert cache.get_or_build("D", {}, lambda: outer) is outer
+
+    def test_module_caches(self):
+        from slots_factory.tools import SlotsFactoryTools
+
+        assert slots_factory.cache is SlotsFactoryTools.type_cache
+        assert fast_slots.cache is SlotsFactoryTools.shape_cache
 
     def test_names(self):
         _name = "category"
@@ -106,9 +275,65 @@ class TestFastSlots:
         assert repr(instance) == "SlotsObject(x=1, y=2)"
 
     def test_caching(self):
-        _ = fast_slots("SlotsObject", x=1, y=2)
-        _ = fast_slots("SlotsObject", x=1, y=2, z=3)
-        assert len(fast_slots.__dict__) == 1
+        # shapes of one name share an entry of the shared cache
+        start = len(fast_slots.cache)
+        _ = fast_slots("CachingObject", x=1, y=2)
+        _ = fast_slots("CachingObject", x=1, y=2, z=3)
+        assert len(fast_slots.cache) == start + 1
+
+    def test_alternating_shapes(self):
+        a, b = fast_slots("Shape", x=1, y=2), fast_slots("Shape", x=1, y=2, z=3)
+        assert type(fast_slots("Shape", x=3, y=4)) is type(a)
+        assert type(fast_slots("Shape", x=3, y=4, z=5)) is type(b)
+        assert type(fast_slots("Shape", y=3, x=4)) is type(a)
+        assert repr(fast_slots("Shape", z=0, y=0, x=0)) == "Shape(x=0, y=0, z=0)"
+
+    def test_shape_cache(self):
+        cache = ShapeCache()
+        assert cache.get("A", {"x": 1}) is None
+        for i in range(4):
+            cache.set("A", {f"k{i}": 0}, i)
+        assert len(cache) == 1
+        assert all(cache.get("A", {f"k{i}": 0}) == i for i in range(4))
+
+        cache.set("A", {"k4": 0}, 4)
+        assert cache.get("A", {"k0": 0}) is None
+        assert cache.get("A", {"k4": 0}) == 4
+        assert cache.get("A", {"k4": 0, "k1": 0}) is None
+
+        cache.clear()
+        assert len(cache) == 0
+
+    def test_shape_cache_after_clear(self):
+        # tp_clear, as the collector calls it on a cache in a cycle
+        Py_tp_clear = 51
+        get_slot = ctypes.pythonapi.PyType_GetSlot
+        get_slot.argtypes, get_slot.restype = (ctypes.py_object, ctypes.c_int), ctypes.c_void_p
+        tp_clear = ctypes.PYFUNCTYPE(ctypes.c_int, ctypes.py_object)(get_slot(ShapeCache, Py_tp_clear))
+
+        cache = ShapeCache()
+        cache.set("A", {"x": 0}, 1)
+        assert tp_clear(cache) == 0
+        assert len(cache) == 0 and cache.get("A", {"x": 0}) is None
+        cache.clear()
+        cache.set("A", {"x": 0}, 2)
+        assert cache.get("A", {"x": 0}) == 2
+
+    def test_threaded_construction(self):
+        results = []
+        barrier = threading.Barrier(8)
+
+        def construct():
+            barrier.wait()
+            results.append(type(fast_slots("Threaded", a=1, b=2)))
+            results.append(type(slots_factory("Threaded", a=1, b=2)))
+
+        threads = [threading.Thread(target=construct) for _ in range(8)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        assert len(set(results[::2])) == 1 and len(set(results[1::2])) == 1
 
 
 class TestSlotsFromType:
@@ -118,6 +343,14 @@ class TestSlotsFromType:
         assert instance.y == 2
         assert instance.z == 3
 
+    def test_slots_from_type_errors(self, type_):
+        with pytest.raises(TypeError):
+            slots_from_type(type_, 1)
+        with pytest.raises(TypeError):
+            slots_from_type(object(), x=1)
+        with pytest.raises(AttributeError):
+            slots_from_type(type_, a=1)
+
 
 class TestTypeFactory:
     def test_type_factory(self):
@@ -199,7 +432,28 @@ class TestDataSlots:
             z: int
 
         assert F.__init__.__doc__ == "frozen"
-        
+
+    def test_native_init(self):
+        @dataslots(order=True)
+        class This:
+            x: int = 1
+            y: list = lambda: []
+            z = lambda self: self.x + 1
+
+        assert isinstance(This.__init__, SlotsInit)
+        assert This.__init__.__doc__ == "generic"
+        assert This.__init__.__dict__["_defaults"] == {"x": 1}
+
+        this = This(x=2)
+        assert (this.x, this.y, this.z) == (2, [], 3)
+
+        with pytest.raises(TypeError):
+            This(1)
+
+        with pytest.raises(AttributeError) as e:
+            This(a=1)
+        assert e.value.args == ("Cannot set attribute",)
+
     def test_default_iter(self):
         @dataslots
         class That:
@@ -293,6 +547,76 @@ class TestDataSlots:
         this = This(x=7, y=8, z=9)
         assert not this <= that
 
+    def test_native_comparisons(self, _ordered_types):
+        This, That = _ordered_types
+        assert type(This.__eq__).__name__ == "method_descriptor"
+        assert hash(This()) == hash(That()) == hash(("x", "y", "z"))
+        assert len({This(x=1), This(x=1), This(x=2)}) == 2
+        assert This() != 1 and not This() == None
+
+        unset = This.__new__(This)
+        assert unset != This()
+        with pytest.raises(AttributeError):
+            _ = unset < This()
+
+    def test_native_comparisons_order(self):
+        @dataslots(order=["z", "x"])
+        class This:
+            x: int
+            y: int
+            z: int
+
+        assert This(x=2, y=0, z=1) < This(x=1, y=0, z=2)
+        assert This(x=1, y=5, z=1) <= This(x=1, y=5, z=2)
+        assert not This(x=1, y=5, z=1) < This(x=1, y=0, z=1)
+
+    def test_single_pass_orderings(self):
+        @dataslots(order=["y"])
+        class This:
+            x: int
+            y: int
+
+        one, two = This(x=1, y=1), This(x=2, y=1)
+        assert not one < two and not one > two
+        assert not one <= two and not one >= two
+        assert one <= This(x=1, y=1) and one >= This(x=1, y=1)
+        assert This(x=9, y=0) < one <= This(x=0, y=2) and This(x=0, y=2) > one
+
+    def test_sort_key(self):
+        @dataslots(order=["z", "x"])
+        class This:
+            x: int
+            y: int
+            z: int
+
+        items = [This(x=i % 3, y=i, z=-(i % 2)) for i in range(6)]
+        assert items[3].sort_key() == (-1, 0)
+        assert sorted(items, key=This.sort_key) == sorted(items)
+        assert [item.y for item in sorted(items, key=This.sort_key)] == [3, 1, 5, 0, 4, 2]
+
+        @dataslots
+        class That:
+            x: int
+        assert not hasattr(That, "sort_key")
+
+    def test_user_comparisons(self):
+        @dataslots(order=True)
+        class This:
+            x: int
+
+            def __eq__(self, other):
+                return True
+
+            def __lt__(self, other):
+                return "lt"
+
+        assert This(x=1) == This(x=2)
+        assert (This(x=1) < This(x=2)) == "lt"
+        assert This(x=2) <= This(x=1)
+        assert not This(x=2) > This(x=1)
+        assert This.__slots__ == ["x"]
+        assert hash(This(x=1)) == hash(("x",))
+
 
 class TestDataSlotsOptions:
     def test_frozen(self):
@@ -309,6 +633,44 @@ class TestDataSlotsOptions:
         assert e.type == AttributeError
         assert e.value.args == ("Instance is immutable",)
 
+    def test_frozen_defaults(self):
+        @dataslots(frozen=True)
+        class This:
+            x: int = 1
+            y: list = lambda: []
+            z = lambda self: self.x + 1
+
+        this = This(x=2)
+        assert (this.x, this.y, this.z) == (2, [], 3)
+        with pytest.raises(AttributeError):
+            this.x = 3
+
+    def test_frozen_setattrs_from_object(self):
+        @dataslots(frozen=True)
+        class This:
+            x: int
+            y: int
+
+        this = This(x=1, y=2)
+        _slots_factory_setattrs_from_object(object, this, {}, {}, {"x": 3}, {})
+        assert (this.x, this.y) == (3, 2)
+
+    def test_setattrs_from_other_object(self):
+        calls = []
+
+        class Setter:
+            def __setattr__(self, instance, key, value):
+                calls.append((key, value))
+                object.__setattr__(instance, key, value)
+
+        this = type_factory(("x", "y"))()
+        _slots_factory_setattrs_from_object(Setter(), this, {}, {}, {"x": 3}, {})
+        assert this.x == 3 and calls == [("x", 3)]
+
+        with pytest.raises(AttributeError):
+            _slots_factory_setattrs_from_object(5, this, {}, {}, {"x": 4}, {})
+        assert this.x == 3
+
     def test_order_true(self):
         @dataslots(order=True)
         class This:
@@ -319,6 +681,36 @@ class TestDataSlotsOptions:
         this = This(x=1, y=2, z=3)
         assert [x for x in this] == [("x", 1), ("y", 2), ("z", 3)]
 
+    def test_positional(self):
+        @dataslots(positional=True)
+        class This:
+            x: int
+            y: int = 2
+            z = lambda self: self.x + self.y
+
+        this = This(1)
+        assert (this.x, this.y, this.z) == (1, 2, 3)
+
+        this = This(1, y=3)
+        assert (this.x, this.y, this.z) == (1, 3, 4)
+
+        with pytest.raises(TypeError):
+            This(1, x=1)
+
+        with pytest.raises(TypeError):
+            This(1, 2, 3, 4)
+
+    def test_positional_order(self):
+        @dataslots(positional=True, order=["z", "x", "y"])
+        class This:
+            x: int
+            y: int
+            z: int
+
+        this = This(3, 1, 2)
+        assert (this.x, this.y, this.z) == (1, 2, 3)
+        assert This.__init__.fields == ("z", "x", "y")
+
     def test_order_explicit(self):
         @dataslots(order=["x", "z", "y"])
         class This:
@@ -329,6 +721,265 @@ class TestDataSlotsOptions:
         this = This(x=1, y=2, z=3)
         assert [x for x in this] == [("x", 1), ("z", 3), ("y", 2)]
 
+    def test_pool(self):
+        @dataslots(pool=2)
+        class This:
+            x: object
+            y: int = 2
+
+        class Value:
+            pass
+
+        value = Value()
+        ref = weakref.ref(value)
+        this = This(x=value)
+        address = id(this)
+        del this, value
+        assert ref() is None
+        assert This.__slots_layout__.pool == 2
+        assert This.__slots_layout__.pooled == 1
+
+        this = This(x=1)
+        assert id(this) == address and This.__slots_layout__.pooled == 0
+        assert (this.x, this.y) == (1, 2)
+        assert gc.is_tracked(this)
+
+        items = [This(x=i) for i in range(5)]
+        del items
+        assert This.__slots_layout__.pooled == 2
+
+        # a real subclass, which DSMeta would otherwise flatten
+        Sub = type.__new__(type(This), "Sub", (This,), {"__slots__": ("z",)})
+        sub = Sub(x=1)
+        sub.z = 3
+        del sub
+        assert This.__slots_layout__.pooled == 2
+
+    def test_untracked(self):
+        @dataslots(gc=False)
+        class This:
+            x: int
+            y: str = "y"
+
+        @dataslots
+        class That:
+            x: int
+            y: str = "y"
+
+        this, that = This(x=1), That(x=1)
+        assert not gc.is_tracked(this) and gc.is_tracked(that)
+        assert sys.getsizeof(this) < sys.getsizeof(that)
+        assert (this.x, this.y) == (1, "y")
+        assert this == that
+
+        @dataslots(gc=False, pool=1)
+        class Pooled:
+            x: int
+
+        address = id(Pooled(x=1))
+        pooled = Pooled(x=2)
+        assert id(pooled) == address and not gc.is_tracked(pooled)
+
+    def test_packed(self):
+        @dataslots(packed=True, positional=True, order=["a", "b"])
+        class This:
+            a: int
+            b: float = 1.5
+            c: bool = False
+            name: str = "x"
+
+        @dataslots
+        class That:
+            a: int
+            b: float = 1.5
+            c: bool = False
+            name: str = "x"
+
+        layout = This.__slots_layout__
+        assert layout.packed and layout.direct
+        assert This.__slots__ == That.__slots__
+
+        this = This(2**40, c=True)
+        assert (this.a, this.b, this.c, this.name) == (2**40, 1.5, True, "x")
+        assert this == That(a=2**40, c=True) and this < This(2**40, 2.0)
+        assert this.sort_key() == (2**40, 1.5)
+        assert repr(this) == "This(b=1.5, c=True, name=x, a=1099511627776)"
+        assert This.from_rows([(1, 2)])[0].b == 2.0
+
+        this.b = 3
+        assert this.b == 3.0 and isinstance(this.b, float)
+        with pytest.raises(TypeError):
+            this.a = "a"
+        with pytest.raises(TypeError):
+            this.c = 1
+        with pytest.raises(OverflowError):
+            This(2**64)
+
+    def test_packed_storage(self):
+        @dataslots(packed=True, pool=1)
+        class Point:
+            x: float
+            y: float
+            visible: bool = True
+
+        point = Point(x=1.0, y=2.0)
+        assert not gc.is_tracked(point)
+        assert set(type(point).__mro__[1].__slots_packed__) == {"x", "y", "visible"}
+        assert point.__slots_layout__.packed
+
+        address = id(point)
+        del point
+        assert id(Point(x=0.0, y=0.0)) == address
+
+        # a recycled instance reads the zeros of a fresh one, not the fields
+        # of the instance pooled before it
+        point = Point(x=1.0, y=2.0, visible=False)
+        del point
+        point = Point(y=3.0)
+        assert id(point) == address
+        assert (point.x, point.y, point.visible) == (0.0, 3.0, True)
+
+        @dataslots(packed=True, pool=1)
+        class Named:
+            x: int
+            y: float
+            name: str
+
+        named = Named(x=5, y=2.5, name="a")
+        address = id(named)
+        del named
+        named = Named(name="b")
+        assert id(named) == address
+        assert (named.x, named.y, named.name) == (0, 0.0, "b")
+
+        @dataslots(packed=True)
+        class Empty:
+            name: str
+        assert not Empty.__slots_layout__.packed and gc.is_tracked(Empty(name=""))
+
+    def test_struct_format(self):
+        @dataslots(packed=True)
+        class This:
+            valid: bool
+            x: int
+            y: float
+            name: str = "this"
+
+        assert This.struct_format == "@?qd"
+        assert This.struct_size == struct.calcsize(This.struct_format)
+
+        this = This(valid=True, x=-3, y=2.5)
+        assert bytes(this) == struct.pack(This.struct_format, True, -3, 2.5)
+        assert memoryview(this).readonly
+
+        with pytest.raises(TypeError):
+            This.from_buffer(bytes(this))
+
+    def test_from_buffer(self):
+        @dataslots(packed=True)
+        class This:
+            valid: bool
+            x: int
+            y: float
+
+        records = b"".join(
+            struct.pack(This.struct_format, i % 2 == 0, i, i / 2) for i in range(4)
+        )
+        view = memoryview(records)
+        these = [This.from_buffer(view, i * This.struct_size) for i in range(4)]
+        assert these == [This(valid=i % 2 == 0, x=i, y=i / 2) for i in range(4)]
+        assert This.from_buffer(bytes(these[1])) == these[1]
+        assert This.from_buffer(b"\x02" + records[1:]).valid is True
+
+        with pytest.raises(ValueError):
+            This.from_buffer(records, len(records) - 1)
+        with pytest.raises(ValueError):
+            This.from_buffer(records, -1)
+        with pytest.raises(TypeError):
+            This.from_buffer("records")
+
+    def test_pool_errors(self):
+        with pytest.raises(ValueError):
+            @dataslots(pool=-1)
+            class This:
+                x: int
+
+        with pytest.raises(TypeError):
+            @dataslots(pool=4)
+            class That:
+                x: int
+
+                def __del__(self):
+                    pass
+
+    def test_array(self):
+        @dataslots(packed=True)
+        class This:
+            x: int
+            y: float
+            valid: bool = True
+            name: str = "this"
+
+        array = This.Array(2)
+        array.extend(This(x=i, y=i / 2) for i in range(10))
+        assert len(array) == 10
+        assert array.capacity >= 10
+        assert (array[3].x, array[3].y, array[3].valid, array[3].name) == (3, 1.5, True, "this")
+        assert array[-1].x == 9
+        assert repr(array[1]) == "This[1](valid=True, name=this, x=1, y=0.5)"
+
+        view = array[4]
+        view.x, view.name = 40, "that"
+        assert array[4].x == 40
+        assert view.to_instance() == This(x=40, y=2.0, name="that")
+        with pytest.raises(TypeError):
+            view.valid = 1
+        with pytest.raises(AttributeError):
+            view.z = 1
+
+        sliced = array[2:8:2]
+        assert [row.x for row in sliced] == [2, 40, 6]
+        sliced[0].x = 20
+        assert array[2].x == 2
+
+        with pytest.raises(IndexError):
+            array[10]
+        with pytest.raises(TypeError):
+            array.append(object())
+
+        assert dataslots.array(This, 4).capacity == 4
+
+    def test_array_columns(self):
+        @dataslots(packed=True)
+        class This:
+            x: int
+            y: float
+            valid: bool
+            name: str = "this"
+
+        array = This.Array()
+        array.extend(This(x=i, y=i / 2, valid=i % 2 == 0) for i in range(8))
+
+        x, y, valid = (array.column(name) for name in ("x", "y", "valid"))
+        assert (x.format, y.format, valid.format) == ("q", "d", "?")
+        assert list(x) == list(range(8))
+        assert sum(y) == 14.0
+        assert valid.tolist() == [True, False] * 4
+
+        x[0] = 100
+        assert array[0].x == 100
+
+        with pytest.raises(BufferError):
+            array.extend(This(x=0, y=0.0, valid=True) for _ in range(100))
+        x.release(), y.release(), valid.release()
+        array.extend(This(x=0, y=0.0, valid=True) for _ in range(100))
+        assert len(array) == 108
+
+        with pytest.raises(TypeError):
+            array.column("name")
+        with pytest.raises(KeyError):
+            array.column("z")
+
 
 class TestDataSlotsConversions:
     def test_slots_from_dict(self):
@@ -356,11 +1007,252 @@ class TestDataSlotsConversions:
         this = dataslots.from_dict(dict_)
         assert all(a == b for ((a, _), b) in zip(this, dict_))
 
+    def test_native_conversions(self):
+        @dataslots(order=["x", "z", "y"])
+        class This:
+            x: int
+            y: int
+            z: int
+
+        this = This(x=1, y=2, z=3)
+        assert this.to_dict() == dict(this)
+        assert list(this.to_dict()) == ["x", "z", "y"]
+        assert this.to_tuple() == (1, 3, 2)
+        assert This.from_dict(this.to_dict()) == this
+
+        with pytest.raises(AttributeError):
+            This.from_dict({"w": 1})
+        with pytest.raises(TypeError):
+            This.from_dict([("x", 1)])
+
+        fast = fast_slots(a=1, b="b")
+        assert fast.to_dict() == {"a": 1, "b": "b"}
+        assert fast.to_tuple() == (1, "b")
+
+    def test_asdict(self):
+        @dataslots
+        class Inner:
+            a: int = 1
+
+        @dataslots
+        class Outer:
+            inner: Inner
+            items: list
+            table: dict
+
+        outer = Outer(
+            inner=Inner(a=2),
+            items=[Inner(), (Inner(a=3), "x")],
+            table={"k": Inner(a=4)},
+        )
+        assert outer.asdict() == {
+            "inner": {"a": 2},
+            "items": [{"a": 1}, ({"a": 3}, "x")],
+            "table": {"k": {"a": 4}},
+        }
+        assert outer.to_dict()["inner"] is outer.inner
+
+        loop = []
+        loop.append(loop)
+        with pytest.raises(RecursionError):
+            Outer(inner=None, items=loop, table={}).asdict()
+
     def test_order_preserved(self, dict_):
         ds = dataslots.from_dict(dict_)
         actual = dict(ds)
         assert all(a == b for (a, b) in zip(actual, dict_))
 
+    def test_codec(self):
+        @dataslots(packed=True)
+        class This:
+            x: int
+            y: float
+            valid: bool = True
+            name: str = "this"
+            data: bytes = b"\x00"
+            big: object = 2 ** 80
+            items: list = lambda: [1, (2, 3)]
+            nothing: object = None
+
+        this = This(x=-3, y=1.5)
+        encoded = This.encode(this)
+        assert isinstance(encoded, bytes)
+        assert b"name" not in encoded
+        assert This.decode(encoded) == this
+        assert This.decode(memoryview(encoded)) == this
+
+        these = [this, This(x=2 ** 62, y=-0.0, valid=False, name="")]
+        assert This.decode_many(This.encode_many(these)) == these
+        assert This.decode_many(This.encode_many([])) == []
+
+        unset = This.__new__(This)
+        unset.x = 1
+        decoded = This.decode(This.encode(unset))
+        assert decoded.x == 1
+        with pytest.raises(AttributeError):
+            decoded.name
+
+        with pytest.raises(TypeError):
+            This.encode(object())
+
+    def test_codec_errors(self):
+        @dataslots
+        class This:
+            x: int = 1
+
+        @dataslots
+        class That:
+            y: int = 1
+
+        encoded = This.encode(This())
+        assert This.__slots_layout__.schema != That.__slots_layout__.schema
+        with pytest.raises(ValueError):
+            That.decode(encoded)
+        with pytest.raises(ValueError):
+            This.decode(encoded[:-1])
+        with pytest.raises(ValueError):
+            This.decode(encoded + b"\x00")
+        with pytest.raises(ValueError):
+            This.decode_many(This.encode_many([This()] * 4)[:-1])
+
+    def test_pickle(self):
+        @dataslots
+        class This:
+            x: int = 1
+            items: list = lambda: [1, 2]
+
+        assert This.__qualname__.endswith("<locals>.This")
+        assert This.__module__ == __name__
+
+        this = This(x=2)
+        for protocol in range(2, pickle.HIGHEST_PROTOCOL + 1):
+            that = pickle.loads(pickle.dumps(this, protocol))
+            assert type(that) is This
+            assert that == this
+        assert copy.deepcopy(this) == this
+
+        unset = This.__new__(This)
+        unset.items = []
+        that = pickle.loads(pickle.dumps(unset))
+        assert that.items == []
+        with pytest.raises(AttributeError):
+            that.x
+
+        fast = fast_slots(a=1, b="b")
+        assert pickle.loads(pickle.dumps([fast, fast])) == [fast, fast]
+
+    def test_pickle_unknown_type(self):
+        # a fresh interpreter has not built the fast_slots type yet
+        data = pickle.dumps(fast_slots(_name="Unknown", a=1, b="b"))
+        script = "import pickle, sys; print(pickle.loads(sys.stdin.buffer.read()))"
+        result = subprocess.run(
+            [sys.executable, "-c", script], input=data, capture_output=True, check=True,
+            env={**os.environ, "PYTHONPATH": os.pathsep.join(sys.path)},
+        )
+        assert result.stdout.strip() == b"Unknown(a=1, b=b)"
+
+    def test_pickle_same_schema(self):
+        # types of one qualname and slots share a schema, but each instance
+        # unpickles as its own type in the process that built them
+        def make(n):
+            @dataslots
+            class Point:
+                x: int = 0
+
+                def which(self):
+                    return n
+            return Point
+
+        first, second = make(1), make(2)
+        assert first.__slots_layout__.schema == second.__slots_layout__.schema
+        for this in (first(x=1), second(x=2)):
+            that = pickle.loads(pickle.dumps(this))
+            assert type(that) is type(this) and that.which() == this.which()
+
+        built, shaped = slots_factory(x=1, y=2), fast_slots(x=1, y=2)
+        assert type(pickle.loads(pickle.dumps(built))) is type(built)
+        assert type(pickle.loads(pickle.dumps(shaped))) is type(shaped)
+
+        # elsewhere only the schema is known, which two live types can't share
+        rebuild, (key, *args) = first(x=3).__reduce_ex__(2)
+        with pytest.raises(ValueError):
+            rebuild(key[:3], *args)
+        del second, this, that
+        gc.collect()
+        assert type(rebuild(key[:3], *args)) is first
+
+    def test_pickle_dead_local_type(self):
+        # a class defined in a function can't be rebuilt from its schema once
+        # it is gone: the fast_slots stand-in has another qualname
+        def make():
+            @dataslots
+            class This:
+                x: int = 0
+            return This
+
+        data = pickle.dumps(make()(x=1))
+        gc.collect()
+        with pytest.raises(ValueError):
+            pickle.loads(data)
+
+    def test_pickle_packed(self):
+        @dataslots(packed=True)
+        class This:
+            x: int
+            y: float
+            valid: bool
+            name: str = "this"
+
+        this = This(x=1, y=2.5, valid=True)
+        buffers = []
+        data = pickle.dumps(this, 5, buffer_callback=buffers.append)
+        assert len(buffers) == 1
+        assert bytes(buffers[0].raw()) == bytes(this)
+        assert pickle.loads(data, buffers=buffers) == this
+        assert pickle.loads(pickle.dumps(this, 5)) == this
+        assert pickle.loads(pickle.dumps(this, 4)) == this
+
+
+class TestBatchConstruction:
+    def test_from_rows(self):
+        @dataslots
+        class This:
+            x: int
+            y: int = 2
+            z = lambda self: self.x + self.y
+
+        items = This.from_rows([(1, 1), (2,), [3, 3]])
+        assert [(i.x, i.y, i.z) for i in items] == [(1, 1, 2), (2, 2, 4), (3, 3, 6)]
+        assert all(type(item) is This for item in items)
+
+        with pytest.raises(TypeError):
+            This.from_rows([(1, 2, 3)])
+
+    def test_from_rows_order(self):
+        @dataslots(order=["y", "x"])
+        class This:
+            x: int
+            y: int
+
+        (this,) = This.from_rows(iter([(1, 2)]))
+        assert (this.x, this.y) == (2, 1)
+
+    def test_from_columns(self):
+        @dataslots
+        class This:
+            x: int
+            y: list = lambda: []
+
+        items = This.from_columns({"x": range(3)})
+        assert [item.x for item in items] == [0, 1, 2]
+        assert items[0].y is not items[1].y
+
+        with pytest.raises(ValueError):
+            This.from_columns({"x": [1, 2], "y": [[]]})
+
+        with pytest.raises(AttributeError):
+            This.from_columns({"a": [1]})
+
 
 class TestUserDefinitions:
     def test_no_annotations(self):
@@ -597,6 +1489,215 @@ class TestComposition:
         instance_one.items[-1] = 2
         assert instance_one.items != instance_two.items
 
+    def test_lazy_dependents(self):
+        calls = []
+
+        @dataslots(frozen=True)
+        class This:
+            x: int = 1
+            y = lazy(lambda self: calls.append("y") or self.x * 10)
+
+            @lazy
+            def z(self):
+                calls.append("z")
+                return self.y + 1
+
+        this = This(x=2)
+        assert calls == []
+        assert this.z == 21
+        assert this.z == 21 and this.y == 20
+        assert calls == ["z", "y"]
+        assert isinstance(This.y, lazy)
+        assert len(this) == 3
+
+        @dataslots
+        class That(This):
+            w: int = 0
+
+        assert That(x=3).z == 31
+
+        @dataslots
+        class Other:
+            y: int = 1
+
+        with pytest.raises(TypeError):
+            This.y.__get__(Other())
+        with pytest.raises(TypeError):
+            lazy(1)
+
+        calls.clear()
+        assert This(y=1).y == 1
+        assert calls == []
+
+        # comparisons compute the lazy fields neither side has read yet
+        this = This()
+        assert this == this
+        assert This() == This() and This(x=2) != This()
+        assert hash(This()) == hash(This())
+
+    def test_lazy_override(self):
+        @dataslots
+        class This:
+            x: int = 1
+            y = lazy(lambda self: self.x * 10)
+
+        this = This()
+        this.y = 5
+        assert this.y == 5
+        del this.y
+        this.x = 3
+        assert this.y == 30
+        assert pickle.loads(pickle.dumps(This(x=4))).y == 40
+
+        # deleting a value never computed nor set raises, as for any slot
+        this = This()
+        with pytest.raises(AttributeError) as e:
+            del this.y
+        assert e.value.args == ("y",)
+        assert this.y == 10
+        del this.y
+        with pytest.raises(AttributeError):
+            del this.y
+
+    def test_dependent_order(self):
+        @dataslots
+        class This:
+            total = lambda self: self.double + self.half
+            double = lambda self: self.base * 2
+            half = lambda self: self.base / 2
+            base = lambda self: sum(x for x in self.values)
+            values: list = lambda: [1, 2, 3]
+
+        this = This()
+        assert (this.base, this.double, this.half, this.total) == (6, 12, 3.0, 15.0)
+        assert this.__slots__.index("total") < this.__slots__.index("base")
+
+        @dataslots
+        class That(This):
+            scaled = lambda self: self.total * 10
+
+        assert That().scaled == 150.0
+
+    def test_default_prototype(self):
+        shared = object()
+
+        @dataslots
+        class This:
+            a: int = 1
+            b: float = 2.5
+            c: object = shared
+            d: list = lambda: []
+            e = lambda self: self.a + 1
+
+        first, second = This(), This(a=5, c=None)
+        assert (first.a, first.b, first.c, first.e) == (1, 2.5, shared, 2)
+        assert (second.a, second.c, second.e) == (5, None, 6)
+        assert first.d is not second.d
+
+        @dataslots
+        class That(This):
+            f: str = "f"
+
+        assert That().c is shared and That(b=1.0).b == 1.0
+
+        @dataslots(packed=True)
+        class Packed:
+            x: int = 3
+            y: float = 0.5
+            z: bool = True
+
+        assert Packed().to_tuple() == (3, 0.5, True)
+        assert Packed(y=1.5).to_tuple() == (3, 1.5, True)
+
+    def test_replace(self):
+        calls = []
+
+        @dataslots
+        class This:
+            x: int = 1
+            y: list = lambda: []
+            double = lambda self: self.x * 2
+            plus = lambda self: self.double + 1
+            size = lambda self: calls.append("size") or len(self.y)
+            cached = lazy(lambda self: self.x * 100)
+
+        this = This()
+        assert this.cached == 100
+        del calls[:]
+
+        that = this.replace(x=5)
+        assert (that.x, that.double, that.plus, that.cached) == (5, 10, 11, 500)
+        assert that.y is this.y and that.size == 0 and calls == []
+        assert (this.x, this.double, this.cached) == (1, 2, 100)
+
+        assert this.replace(y=[1, 2]).size == 2 and calls == ["size"]
+        assert this.replace(x=2, double=0).plus == 1
+        assert this.replace(cached=-1).cached == -1
+        assert this.replace() == this and this.replace() is not this
+
+        with pytest.raises(TypeError):
+            this.replace(2)
+        with pytest.raises(AttributeError):
+            this.replace(z=2)
+
+        @dataslots(frozen=True)
+        class Frozen:
+            a: int = 1
+            b = lambda self: self.a + 1
+
+        frozen = Frozen().replace(a=2)
+        assert (frozen.a, frozen.b) == (2, 3)
+        with pytest.raises(AttributeError):
+            frozen.a = 3
+
+    def test_copy(self):
+        @dataslots
+        class This:
+            x: int = 1
+            y: list = lambda: [[1]]
+            z = lambda self: self.x + 1
+
+        this = This()
+        shallow, deep = copy.copy(this), copy.deepcopy(this)
+        assert shallow == this == deep
+        assert shallow.y is this.y
+        assert deep.y == this.y and deep.y is not this.y and deep.y[0] is not this.y[0]
+
+        this.y.append(this)
+        assert copy.deepcopy(this).y[-1].y[-1].x == 1
+        looped = copy.deepcopy(this)
+        assert looped.y[-1] is looped
+
+        @dataslots(packed=True)
+        class Packed:
+            a: int = 7
+            b: float = 0.25
+            c: str = "c"
+
+        packed = Packed(a=3)
+        assert copy.copy(packed).to_tuple() == (3, 0.25, "c")
+        assert copy.deepcopy(packed).to_tuple() == (3, 0.25, "c")
+        assert packed.replace(b=1.0).to_tuple() == (3, 1.0, "c")
+
+    def test_factories_only_for_missing_fields(self):
+        calls = []
+
+        @dataslots(positional=True)
+        class This:
+            x: list = lambda: calls.append("x") or []
+            y: dict = lambda: calls.append("y") or {}
+            z: int = 0
+
+        assert This(x=[1], y={}).x == [1] and calls == []
+        assert This([2]).y == {} and calls == ["y"]
+        assert This().z == 0 and calls == ["y", "x", "y"]
+
+        this = This(x=[], y={})
+        _slots_factory_setattrs_from_object(
+            object, this, {"x": lambda: calls.append("x") or []}, {"z": 1}, {"x": [3], "z": 2}, {}
+        )
+        assert (this.x, this.z) == ([3], 2) and calls == ["y", "x", "y"]
+
     def test_dependent_defaults_error(self):
         with pytest.raises(SyntaxError) as e:
             @dataslots
@@ -607,3 +1708,136 @@ class TestComposition:
             "lambda-type factory functions must take either"
             " 'self' as an argument, or take no arguments",
         )
+
+
+class TestStats:
+    def test_disabled(self):
+        stats.reset()
+        fast_slots(_name="Uncounted", a=1)
+        assert stats() == {"enabled": False, "types": {}, "slots_factory": {}, "fast_slots": {}}
+
+    def test_types(self):
+        @dataslots(frozen=True)
+        class This:
+            x: int = 1
+            y: list = lambda: []
+            z: int = lambda self: self.x + 1
+
+        stats.reset()
+        stats.enable()
+        try:
+            for _ in range(3):
+                This()
+            This.from_rows([(1,), (2,)])
+        finally:
+            stats.disable()
+        This()
+        counters = stats()["types"][This]
+        assert counters["created"] == 5
+        assert counters["frozen"] == 5
+        assert counters["hits"] == 0
+        assert counters["callables_ns"] > 0 and counters["dependents_ns"] > 0
+
+    def test_caches(self):
+        stats.reset()
+        stats.enable()
+        try:
+            for _ in range(3):
+                slots_factory(_name="Counted", a=1)
+            fast_slots(_name="Counted", a=1)
+            fast_slots(_name="Counted", b=1)
+            fast_slots(_name="Counted", a=1)
+        finally:
+            stats.disable()
+        counted = stats()
+        assert counted["slots_factory"]["Counted"] == {"misses": 1, "builds": 1, "rebuilds": 0}
+        assert counted["fast_slots"]["Counted"] == {"misses": 2, "builds": 2, "rebuilds": 1}
+        built = slots_factory(_name="Counted", a=1).__class__
+        assert counted["types"][built] == {
+            "created": 3, "hits": 2, "frozen": 0, "callables_ns": 0, "dependents_ns": 0,
+        }
+        stats.reset()
+        assert stats()["types"] == {} and stats()["fast_slots"] == {}
+
+    def test_environment(self):
+        script = (
+            "from slots_factory import fast_slots, stats\n"
+            "fast_slots(_name='This', a=1)\n"
+            "print(stats()['enabled'], stats()['fast_slots']['This']['builds'])\n"
+        )
+        result = subprocess.run(
+            [sys.executable, "-c", script], capture_output=True, check=True,
+            env={**os.environ, "PYTHONPATH": os.pathsep.join(sys.path), "SLOTS_FACTORY_STATS": "1"},
+        )
+        assert result.stdout.split() == [b"True", b"1"]
+
+
+class TestCompiler:
+    MODELS = (
+        "from slots_factory import dataslots\n"
+        "@dataslots\n"
+        "class Point:\n"
+        "    x: int\n"
+        "    tags: list = lambda: []\n"
+        "    z: int = lambda self: self.x + 1\n"
+        "@dataslots(packed=True, positional=True)\n"
+        "class Packed:\n"
+        "    x: int = 1\n"
+        "    name: str = 'packed'\n"
+        "    y: float = 2.0\n"
+        "    on: bool = True\n"
+    )
+    CHECK = (
+        "import struct, warnings\n"
+        "with warnings.catch_warnings(record=True) as caught:\n"
+        "    warnings.simplefilter('always')\n"
+        "    from compiled_models import Point, Packed\n"
+        "print(Point.__mro__[1].__module__, Packed.__mro__[1].__module__, len(caught))\n"
+        "point, packed = Point(x=1), Packed(2, 'two', 3.5)\n"
+        "assert (point.x, point.tags, point.z) == (1, [], 2), point\n"
+        "assert struct.unpack(Packed.struct_format, bytes(packed))[:3] == (2, 3.5, True), packed\n"
+        "assert (packed.x, packed.name, packed.y, packed.on) == (2, 'two', 3.5, True)\n"
+        "assert Packed.decode(Packed.encode(packed)) == packed\n"
+        "assert Point(**{'x': 5}).z == 6\n"
+    )
+
+    def test_schema(self):
+        @dataslots(packed=True)
+        class This:
+            x: int = 1
+            name: str = "this"
+            y: float = 2.0
+
+        assert compiler.schema(This) == [("x", "q"), ("name", None), ("y", "d")]
+        source = compiler.generate(This.__module__, [This])
+        assert "long long f0;  // x" in source and "PyObject *f1;  // name" in source
+        assert compiler.compiled_module("pkg.models") == "pkg.models_slots"
+        with pytest.raises(TypeError):
+            compiler.schema(type_factory(("x",)))
+
+    def test_compiled(self):
+        try:
+            import setuptools  # noqa: F401
+        except ImportError:
+            pytest.skip("building extensions needs setuptools")
+
+        def run(directory, *args, **env):
+            result = subprocess.run(
+                [sys.executable, *args], cwd=directory, capture_output=True,
+                env={**os.environ, "PYTHONPATH": os.pathsep.join([directory, *sys.path]), **env},
+            )
+            assert result.returncode == 0, result.stderr.decode()
+            return result.stdout.split()
+
+        with tempfile.TemporaryDirectory() as directory:
+            with open(os.path.join(directory, "compiled_models.py"), "w") as f:
+                f.write(self.MODELS)
+            run(directory, "-m", "slots_factory.compiler", "compiled_models", "--build")
+
+            assert run(directory, "-c", self.CHECK) == [b"compiled_models_slots", b"compiled_models_slots", b"0"]
+            assert run(directory, "-c", self.CHECK, SLOTS_FACTORY_COMPILED="0")[-1] == b"0"
+
+            # a class changed since it was compiled falls back, with a warning
+            with open(os.path.join(directory, "compiled_models.py"), "a") as f:
+                f.write("    extra: int = 0\n")
+            assert run(directory, "-c", self.CHECK) == [b"compiled_models_slots", b"slots_factory", b"1"]